@@ -0,0 +1,674 @@
+// tarprocess 基准测试：生成可复现的合成语料，端到端运行 tarprocess，输出每个场景的 files/s、MB/s 和峰值 RSS
+//
+// 编译：gcc -O2 -o tarprocess-bench bench/bench.c -lz -lbz2 -llzma
+// 用法：tarprocess-bench [-r RUNS] [-s SCALE] [-w DIR] [-o FILE] [-k] <tarprocess binary> [tarprocess args...]
+//
+// 语料由固定种子的伪随机数生成，同一 SCALE 下逐字节相同，不同提交的结果可以直接比较。
+// 每个场景运行 RUNS 次取耗时中位数；峰值 RSS 为 tarprocess 进程本身（不含它启动的 unzip 等子进程）
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+
+#define NEST_LEVELS 11          // 顶层 tar 内的第 1 层在深度 0，最内层正好到 recursive_extract() 的深度上限 10
+#define MAX_RUNS  32
+
+/*========== 1. 伪随机内容 ==========*/
+
+static uint64_t rng_state;
+
+static void rng_seed(uint64_t seed) {
+    rng_state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+// xorshift64*
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t rng_range(uint64_t lo, uint64_t hi) {
+    return lo + rng_next() % (hi - lo + 1);
+}
+
+// 可压缩的类 C 源码文本
+static void fill_text(uint8_t *buf, size_t n) {
+    size_t pos = 0;
+    while (pos < n) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "static int f%u(int x) { return x * %u + %u; }\n",
+                           (unsigned)(rng_next() % 10000), (unsigned)(rng_next() % 97), (unsigned)(rng_next() % 1000));
+        size_t take = (size_t)len < n - pos ? (size_t)len : n - pos;
+        memcpy(buf + pos, line, take);
+        pos += take;
+    }
+}
+
+// 不可压缩的随机字节
+static void fill_random(uint8_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+        uint64_t v = rng_next();
+        memcpy(buf + i, &v, n - i < 8 ? n - i : 8);
+    }
+}
+
+/*========== 2. 归档与压缩 ==========*/
+
+// 内存中的字节串
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+} Blob;
+
+static void blob_free(Blob *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+}
+
+// 写一个 ustar 头部（mtime 固定，保证逐字节可复现）
+static void tar_header(FILE *fp, const char *name, uint64_t size) {
+    uint8_t h[512];
+    memset(h, 0, sizeof(h));
+    snprintf((char *)h, 100, "%s", name);
+    memcpy(h + 100, "0000644", 7);
+    memcpy(h + 108, "0000000", 7);
+    memcpy(h + 116, "0000000", 7);
+    snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+    memcpy(h + 136, "14000000000", 11);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (int i = 0; i < 512; i++) sum += h[i];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    fwrite(h, 1, sizeof(h), fp);
+}
+
+static void tar_pad(FILE *fp, uint64_t size) {
+    static const uint8_t zero[512];
+    if (size % 512) fwrite(zero, 1, 512 - size % 512, fp);
+}
+
+static void tar_add(FILE *fp, const char *name, const uint8_t *data, size_t len) {
+    tar_header(fp, name, len);
+    fwrite(data, 1, len, fp);
+    tar_pad(fp, len);
+}
+
+static void tar_end(FILE *fp) {
+    static const uint8_t zero[1024];
+    fwrite(zero, 1, sizeof(zero), fp);
+}
+
+// 正在内存中构建的 tar 包
+typedef struct {
+    FILE  *fp;
+    char  *data;
+    size_t len;
+} MemTar;
+
+static void memtar_open(MemTar *t) {
+    t->data = NULL;
+    t->len = 0;
+    t->fp = open_memstream(&t->data, &t->len);
+}
+
+static Blob memtar_close(MemTar *t) {
+    tar_end(t->fp);
+    fclose(t->fp);
+    Blob b = { (uint8_t *)t->data, t->len };
+    return b;
+}
+
+static Blob compress_gzip(const Blob *in) {
+    Blob out = { NULL, 0 };
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return out;
+    size_t cap = deflateBound(&zs, in->len) + 32;
+    out.data = malloc(cap);
+    zs.next_in = in->data;
+    zs.avail_in = (uInt)in->len;
+    zs.next_out = out.data;
+    zs.avail_out = (uInt)cap;
+    deflate(&zs, Z_FINISH);
+    out.len = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+static Blob compress_bzip2(const Blob *in) {
+    Blob out;
+    unsigned int cap = (unsigned int)(in->len + in->len / 100 + 600);
+    out.data = malloc(cap);
+    if (BZ2_bzBuffToBuffCompress((char *)out.data, &cap, (char *)in->data, (unsigned int)in->len, 9, 0, 0) != BZ_OK) cap = 0;
+    out.len = cap;
+    return out;
+}
+
+static Blob compress_xz(const Blob *in) {
+    Blob out;
+    size_t cap = lzma_stream_buffer_bound(in->len);
+    size_t pos = 0;
+    out.data = malloc(cap);
+    if (lzma_easy_buffer_encode(1, LZMA_CHECK_CRC64, NULL, in->data, in->len, out.data, &pos, cap) != LZMA_OK) pos = 0;
+    out.len = pos;
+    return out;
+}
+
+// zstd 帧，只用原样块（不依赖 libzstd，tarprocess 照样要走完整的解码路径）
+static Blob compress_zstd(const Blob *in) {
+    Blob out;
+    size_t blocks = in->len / (128 << 10) + 1;
+    out.data = malloc(in->len + blocks * 3 + 16);
+    uint8_t *p = out.data;
+    static const uint8_t magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+    memcpy(p, magic, 4);
+    p += 4;
+    *p++ = 0xA0;                        // 单段，4 字节内容大小
+    for (int i = 0; i < 4; i++) *p++ = (uint8_t)(in->len >> (8 * i));
+    size_t pos = 0;
+    do {
+        size_t n = in->len - pos < (128 << 10) ? in->len - pos : (128 << 10);
+        uint32_t hdr = (uint32_t)(n << 3) | (pos + n == in->len ? 1 : 0);
+        *p++ = (uint8_t)hdr;
+        *p++ = (uint8_t)(hdr >> 8);
+        *p++ = (uint8_t)(hdr >> 16);
+        memcpy(p, in->data + pos, n);
+        p += n;
+        pos += n;
+    } while (pos < in->len);
+    out.len = (size_t)(p - out.data);
+    return out;
+}
+
+static void put16(FILE *fp, unsigned v) {
+    fputc(v & 0xFF, fp);
+    fputc((v >> 8) & 0xFF, fp);
+}
+
+static void put32(FILE *fp, uint32_t v) {
+    put16(fp, v & 0xFFFF);
+    put16(fp, v >> 16);
+}
+
+// 不压缩（stored）的 zip 包
+typedef struct {
+    MemTar   mem;               // 复用内存流
+    char     names[64][64];
+    uint32_t crc[64], size[64], offset[64];
+    int      count;
+} MemZip;
+
+static void memzip_open(MemZip *z) {
+    memtar_open(&z->mem);
+    z->count = 0;
+}
+
+static void memzip_add(MemZip *z, const char *name, const uint8_t *data, size_t len) {
+    if (z->count == 64) return;
+    FILE *fp = z->mem.fp;
+    int i = z->count++;
+    snprintf(z->names[i], sizeof(z->names[i]), "%s", name);
+    z->crc[i] = (uint32_t)crc32(0, data, (uInt)len);
+    z->size[i] = (uint32_t)len;
+    z->offset[i] = (uint32_t)ftell(fp);
+    put32(fp, 0x04034b50);
+    put16(fp, 20); put16(fp, 0); put16(fp, 0);
+    put16(fp, 0); put16(fp, 0x21);      // 1980-01-01
+    put32(fp, z->crc[i]); put32(fp, z->size[i]); put32(fp, z->size[i]);
+    put16(fp, (unsigned)strlen(z->names[i])); put16(fp, 0);
+    fputs(z->names[i], fp);
+    fwrite(data, 1, len, fp);
+}
+
+static Blob memzip_close(MemZip *z) {
+    FILE *fp = z->mem.fp;
+    uint32_t cd_start = (uint32_t)ftell(fp);
+    for (int i = 0; i < z->count; i++) {
+        put32(fp, 0x02014b50);
+        put16(fp, 20); put16(fp, 20); put16(fp, 0); put16(fp, 0);
+        put16(fp, 0); put16(fp, 0x21);
+        put32(fp, z->crc[i]); put32(fp, z->size[i]); put32(fp, z->size[i]);
+        put16(fp, (unsigned)strlen(z->names[i])); put16(fp, 0); put16(fp, 0);
+        put16(fp, 0); put16(fp, 0); put32(fp, 0);
+        put32(fp, z->offset[i]);
+        fputs(z->names[i], fp);
+    }
+    uint32_t cd_size = (uint32_t)ftell(fp) - cd_start;
+    put32(fp, 0x06054b50);
+    put16(fp, 0); put16(fp, 0);
+    put16(fp, (unsigned)z->count); put16(fp, (unsigned)z->count);
+    put32(fp, cd_size); put32(fp, cd_start);
+    put16(fp, 0);
+    fclose(fp);
+    Blob b = { (uint8_t *)z->mem.data, z->mem.len };
+    return b;
+}
+
+/*========== 3. 场景 ==========*/
+
+enum { CODEC_GZ, CODEC_BZ2, CODEC_XZ, CODEC_ZST, CODEC_ZIP, CODEC_TAR, CODECS };
+static const char *const codec_ext[CODECS] = { ".tar.gz", ".tar.bz2", ".tar.xz", ".tar.zst", ".zip", ".tar" };
+
+static Blob compress_with(int codec, Blob *tar) {
+    Blob out;
+    switch (codec) {
+    case CODEC_GZ:  out = compress_gzip(tar); break;
+    case CODEC_BZ2: out = compress_bzip2(tar); break;
+    case CODEC_XZ:  out = compress_xz(tar); break;
+    case CODEC_ZST: out = compress_zstd(tar); break;
+    default:        return *tar;
+    }
+    blob_free(tar);
+    return out;
+}
+
+// 一个含 nfiles 个小文件的压缩包（zip 或按 codec 压缩的 tar）
+static Blob small_archive(int codec, int nfiles, const char *prefix) {
+    char name[96];
+    uint8_t buf[2048];
+    if (codec == CODEC_ZIP) {
+        MemZip z;
+        memzip_open(&z);
+        for (int i = 0; i < nfiles; i++) {
+            size_t len = rng_range(32, sizeof(buf));
+            fill_text(buf, len);
+            snprintf(name, sizeof(name), "%s/f%03d%s", prefix, i, i % 3 == 0 ? ".c" : ".txt");
+            memzip_add(&z, name, buf, len);
+        }
+        return memzip_close(&z);
+    }
+    MemTar t;
+    memtar_open(&t);
+    for (int i = 0; i < nfiles; i++) {
+        size_t len = rng_range(32, sizeof(buf));
+        fill_text(buf, len);
+        snprintf(name, sizeof(name), "%s/f%03d%s", prefix, i, i % 3 == 0 ? ".c" : ".txt");
+        tar_add(t.fp, name, buf, len);
+    }
+    Blob tar = memtar_close(&t);
+    return compress_with(codec, &tar);
+}
+
+// 大量小文件：20000 个 0~512 字节的文件，平铺在 200 个目录里
+static void gen_tiny(FILE *fp, double scale) {
+    static const char *const exts[] = { ".c", ".h", ".txt", ".dat" };
+    int n = (int)(20000 * scale);
+    uint8_t buf[512];
+    char name[64];
+    for (int i = 0; i < n; i++) {
+        size_t len = rng_range(0, sizeof(buf));
+        fill_text(buf, len);
+        snprintf(name, sizeof(name), "d%03d/f%05d%s", i % 200, i, exts[i % 4]);
+        tar_add(fp, name, buf, len);
+    }
+}
+
+// 少量大文件：可压缩文本和随机数据各一个，另有一个装着大文本的 tar.gz
+static void gen_huge(FILE *fp, double scale) {
+    size_t size = (size_t)((64 << 20) * scale);
+    size_t chunk = 1 << 20;
+    uint8_t *buf = malloc(chunk);
+
+    tar_header(fp, "big/text.log", size);
+    for (size_t done = 0; done < size; done += chunk) {
+        size_t n = size - done < chunk ? size - done : chunk;
+        fill_text(buf, n);
+        fwrite(buf, 1, n, fp);
+    }
+    tar_pad(fp, size);
+
+    tar_header(fp, "big/random.bin", size);
+    for (size_t done = 0; done < size; done += chunk) {
+        size_t n = size - done < chunk ? size - done : chunk;
+        fill_random(buf, n);
+        fwrite(buf, 1, n, fp);
+    }
+    tar_pad(fp, size);
+    free(buf);
+
+    Blob text = { malloc(size / 2), size / 2 };
+    fill_text(text.data, text.len);
+    MemTar inner;
+    memtar_open(&inner);
+    tar_add(inner.fp, "inner/text.c", text.data, text.len);
+    blob_free(&text);
+    Blob tar = memtar_close(&inner);
+    Blob gz = compress_with(CODEC_GZ, &tar);
+    tar_add(fp, "big/inner.tar.gz", gz.data, gz.len);
+    blob_free(&gz);
+}
+
+// 深层嵌套：每层一个压缩包（编解码器轮换），装着几个小文件和下一层，直到深度限制
+static Blob deep_level(int level, int nfiles) {
+    char name[96];
+    uint8_t buf[1024];
+    int codec = level % CODECS;
+    Blob child = { NULL, 0 };
+    if (level < NEST_LEVELS) child = deep_level(level + 1, nfiles);
+
+    if (codec == CODEC_ZIP) {
+        MemZip z;
+        memzip_open(&z);
+        for (int i = 0; i < nfiles; i++) {
+            size_t len = rng_range(16, sizeof(buf));
+            fill_text(buf, len);
+            snprintf(name, sizeof(name), "L%02d/f%02d.c", level, i);
+            memzip_add(&z, name, buf, len);
+        }
+        if (child.data) {
+            snprintf(name, sizeof(name), "L%02d/level%02d%s", level, level + 1, codec_ext[(level + 1) % CODECS]);
+            memzip_add(&z, name, child.data, child.len);
+        }
+        blob_free(&child);
+        return memzip_close(&z);
+    }
+
+    MemTar t;
+    memtar_open(&t);
+    for (int i = 0; i < nfiles; i++) {
+        size_t len = rng_range(16, sizeof(buf));
+        fill_text(buf, len);
+        snprintf(name, sizeof(name), "L%02d/f%02d.c", level, i);
+        tar_add(t.fp, name, buf, len);
+    }
+    if (child.data) {
+        snprintf(name, sizeof(name), "L%02d/level%02d%s", level, level + 1, codec_ext[(level + 1) % CODECS]);
+        tar_add(t.fp, name, child.data, child.len);
+    }
+    blob_free(&child);
+    Blob tar = memtar_close(&t);
+    return compress_with(codec, &tar);
+}
+
+static void gen_deep(FILE *fp, double scale) {
+    int chains = (int)(20 * scale) > 0 ? (int)(20 * scale) : 1;
+    char name[64];
+    for (int c = 0; c < chains; c++) {
+        Blob b = deep_level(1, 8);
+        snprintf(name, sizeof(name), "chain%03d/level01%s", c, codec_ext[1 % CODECS]);
+        tar_add(fp, name, b.data, b.len);
+        blob_free(&b);
+    }
+}
+
+// 混合编解码器：每种压缩包若干个，外加单文件压缩
+static void gen_codecs(FILE *fp, double scale) {
+    int per_codec = (int)(40 * scale) > 0 ? (int)(40 * scale) : 1;
+    char name[96], prefix[32];
+    uint8_t buf[4096];
+    for (int i = 0; i < per_codec; i++) {
+        for (int codec = 0; codec < CODECS; codec++) {
+            snprintf(prefix, sizeof(prefix), "a%03d", i);
+            Blob b = small_archive(codec, 50, prefix);
+            snprintf(name, sizeof(name), "mix/a%03d%s", i, codec_ext[codec]);
+            tar_add(fp, name, b.data, b.len);
+            blob_free(&b);
+        }
+        // 单文件压缩（.gz / .bz2 / .xz / .zst）
+        for (int codec = CODEC_GZ; codec <= CODEC_ZST; codec++) {
+            Blob raw = { malloc(sizeof(buf)), sizeof(buf) };
+            fill_text(raw.data, raw.len);
+            Blob b = compress_with(codec, &raw);
+            snprintf(name, sizeof(name), "mix/s%03d.c%s", i, codec_ext[codec] + 4);
+            tar_add(fp, name, b.data, b.len);
+            blob_free(&b);
+        }
+    }
+}
+
+// 改过扩展名的文件：内容与扩展名不符（交给 magic_tbl 判断），另有同样多的正常文件作对照
+static void gen_misnamed(FILE *fp, double scale) {
+    static const struct {
+        uint8_t     sig[8];
+        int         sig_len;
+        const char *right, *wrong;
+    } kinds[] = {
+        { { 0x89, 'P', 'N', 'G' },        4, ".png", ".dat" },
+        { { 0xFF, 0xD8, 0xFF },           3, ".jpg", ".txt" },
+        { { '%', 'P', 'D', 'F' },         4, ".pdf", ".png" },
+        { { 0x7F, 'E', 'L', 'F' },        4, "",     ".txt" },
+        { { 'M', 'Z' },                   2, ".exe", ".jpg" },
+        { { 'O', 'g', 'g', 'S' },         4, ".ogg", ".mp3" },
+    };
+    int nkinds = (int)(sizeof(kinds) / sizeof(kinds[0]));
+    int n = (int)(2000 * scale) > 0 ? (int)(2000 * scale) : 1;
+    uint8_t buf[1024];
+    char name[64];
+    for (int i = 0; i < n; i++) {
+        int k = i % nkinds;
+        size_t len = rng_range(64, sizeof(buf));
+        fill_random(buf, len);
+        memcpy(buf, kinds[k].sig, kinds[k].sig_len);
+        snprintf(name, sizeof(name), "m/f%05d%s", i, (i / nkinds) % 2 ? kinds[k].wrong : kinds[k].right);
+        tar_add(fp, name, buf, len);
+
+        // 压缩包改名：gzip 叫 .txt，zip 叫 .jpg，tar 叫 .bin
+        if (i % 50 == 0) {
+            static const int codecs[] = { CODEC_GZ, CODEC_ZIP, CODEC_TAR };
+            static const char *const names[] = { ".txt", ".jpg", ".bin" };
+            int c = (i / 50) % 3;
+            Blob b = small_archive(codecs[c], 10, "renamed");
+            snprintf(name, sizeof(name), "m/archive%05d%s", i, names[c]);
+            tar_add(fp, name, b.data, b.len);
+            blob_free(&b);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    uint64_t    seed;
+    void      (*gen)(FILE *fp, double scale);
+} scenarios[] = {
+    { "tiny",     1, gen_tiny },
+    { "huge",     2, gen_huge },
+    { "deep",     3, gen_deep },
+    { "codecs",   4, gen_codecs },
+    { "misnamed", 5, gen_misnamed },
+};
+#define SCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+/*========== 4. 运行与测量 ==========*/
+
+static uint64_t walk_files, walk_bytes;
+
+static int count_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)path; (void)ftw;
+    if (type == FTW_F) {
+        walk_files++;
+        walk_bytes += (uint64_t)st->st_size;
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st; (void)type; (void)ftw;
+    remove(path);
+    return 0;
+}
+
+static void remove_tree(const char *path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    double   seconds;
+    long     rss_kb;
+    uint64_t files, bytes;
+    int      status;
+} RunResult;
+
+// 在空目录 run_dir 中运行一次 tarprocess，标准输出丢弃
+static RunResult run_once(char **tool_argv, int tool_argc, const char *corpus, const char *run_dir) {
+    RunResult r = { 0, 0, 0, 0, -1 };
+    mkdir(run_dir, 0755);
+
+    char **argv = calloc(tool_argc + 2, sizeof(char *));
+    for (int i = 0; i < tool_argc; i++) argv[i] = tool_argv[i];
+    argv[tool_argc] = (char *)corpus;
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (chdir(run_dir) != 0) _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    free(argv);
+    if (pid < 0) return r;
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR) {
+    }
+    r.seconds = now_seconds() - start;
+    r.rss_kb = ru.ru_maxrss;
+    r.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    char result_dir[4300];
+    snprintf(result_dir, sizeof(result_dir), "%s/result", run_dir);
+    walk_files = walk_bytes = 0;
+    nftw(result_dir, count_file, 64, FTW_PHYS);
+    r.files = walk_files;
+    r.bytes = walk_bytes;
+    remove_tree(run_dir);
+    return r;
+}
+
+static int cmp_seconds(const void *a, const void *b) {
+    double x = ((const RunResult *)a)->seconds, y = ((const RunResult *)b)->seconds;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *prog) {
+    printf("use: %s [-r RUNS] [-s SCALE] [-w DIR] [-o FILE] [-k] <tarprocess binary> [tarprocess args...]\n", prog);
+    printf("  -r RUNS    runs per scenario, the median is reported (default 3)\n");
+    printf("  -s SCALE   corpus size factor (default 1.0)\n");
+    printf("  -w DIR     work directory for corpora and runs (default bench_work)\n");
+    printf("  -o FILE    append one JSON line per scenario to FILE\n");
+    printf("  -k         keep generated corpora\n");
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 3, keep = 0;
+    double scale = 1.0;
+    const char *work = "bench_work";
+    const char *json_path = NULL;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) scale = atof(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) work = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0) keep = 1;
+        else break;
+    }
+    if (i >= argc || runs < 1 || runs > MAX_RUNS || scale <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // 子进程在各自的运行目录里执行，二进制和语料都用绝对路径
+    char tool[4096];
+    if (!realpath(argv[i], tool)) {
+        printf("Error: Can not find the file: %s\n", argv[i]);
+        return 1;
+    }
+    argv[i] = tool;
+    char **tool_argv = argv + i;
+    int tool_argc = argc - i;
+
+    mkdir(work, 0755);
+    char work_abs[4096];
+    if (!realpath(work, work_abs)) {
+        printf("Error: Can not create the work directory: %s\n", work);
+        return 1;
+    }
+
+    FILE *json = NULL;
+    if (json_path && !(json = fopen(json_path, "a"))) {
+        printf("Error: Unable to open the file, %s\n", json_path);
+        return 1;
+    }
+
+    printf("%-10s %9s %9s %9s %9s %10s %9s %9s\n", "scenario", "input MB", "files", "out MB", "time s",
+           "files/s", "MB/s", "RSS MB");
+    int failed = 0;
+    for (int s = 0; s < SCENARIOS; s++) {
+        char corpus[4200], run_dir[4200];
+        snprintf(corpus, sizeof(corpus), "%s/%s-%g.tar", work_abs, scenarios[s].name, scale);
+        snprintf(run_dir, sizeof(run_dir), "%s/run", work_abs);
+
+        // 语料按名称和 SCALE 缓存，内容由固定种子决定
+        struct stat st;
+        if (stat(corpus, &st) != 0) {
+            FILE *fp = fopen(corpus, "wb");
+            if (!fp) {
+                printf("Error: Unable to open the file, %s\n", corpus);
+                return 1;
+            }
+            rng_seed(scenarios[s].seed);
+            scenarios[s].gen(fp, scale);
+            tar_end(fp);
+            fclose(fp);
+            stat(corpus, &st);
+        }
+
+        RunResult results[MAX_RUNS];
+        long rss = 0;
+        for (int r = 0; r < runs; r++) {
+            results[r] = run_once(tool_argv, tool_argc, corpus, run_dir);
+            if (results[r].status != 0) failed = 1;
+            if (results[r].rss_kb > rss) rss = results[r].rss_kb;
+        }
+        qsort(results, runs, sizeof(RunResult), cmp_seconds);
+        RunResult *m = &results[runs / 2];
+        double out_mb = m->bytes / 1048576.0;
+
+        printf("%-10s %9.1f %9llu %9.1f %9.3f %10.0f %9.1f %9.1f%s\n", scenarios[s].name, st.st_size / 1048576.0,
+               (unsigned long long)m->files, out_mb, m->seconds, m->files / m->seconds, out_mb / m->seconds,
+               rss / 1024.0, m->status != 0 ? "  (exit status != 0)" : "");
+        if (json) {
+            fprintf(json, "{\"scenario\":\"%s\",\"scale\":%g,\"runs\":%d,\"input_bytes\":%lld,\"files\":%llu,"
+                          "\"output_bytes\":%llu,\"seconds\":%.6f,\"files_per_s\":%.1f,\"mb_per_s\":%.2f,"
+                          "\"peak_rss_kb\":%ld,\"status\":%d}\n",
+                    scenarios[s].name, scale, runs, (long long)st.st_size, (unsigned long long)m->files,
+                    (unsigned long long)m->bytes, m->seconds, m->files / m->seconds, out_mb / m->seconds, rss,
+                    m->status);
+        }
+        if (!keep) remove(corpus);
+    }
+
+    if (json) fclose(json);
+    if (!keep) rmdir(work_abs);
+    return failed;
+}
@@ -1,40 +1,285 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE           // copy_file_range
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+#include "tarprocess.h"
 
 #ifdef _WIN32
     #include <direct.h>
     #include <io.h>
+    #include <fcntl.h>
+    #include <process.h>
     #define my_mkdir(path) _mkdir(path)
     #define access _access
+    #define getpid _getpid
     #define F_OK 0
-    #define extcasecmp _stricmp   // MSVC / MinGW ´Сд޹رȽ
+    #define extcasecmp _stricmp   // MSVC / MinGW 下大小写无关比较
 #else
     #include <unistd.h>
     #include <dirent.h>
     #include <libgen.h>
+    #include <fcntl.h>
+    #include <errno.h>
+    #include <sys/mman.h>
+    #include <sys/file.h>
+    #include <sys/wait.h>
+    #include <spawn.h>
+    #include <signal.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
     #define my_mkdir(path) mkdir(path, 0755)
     #define extcasecmp strcasecmp // POSIX
 #endif
 
-// 
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+        #define HAVE_IO_URING 1
+    #endif
+#endif
+
+#ifdef __linux__
+    #include <sys/ioctl.h>
+    #include <sys/sendfile.h>
+    #include <sys/resource.h>
+    #include <linux/fs.h>
+    #ifndef FICLONE
+        #define FICLONE _IOW(0x94, 9, int)
+    #endif
+#endif
+
+// 函数声明
 int is_c_file(const char *filename);
 int is_archive_file(const char *filename);
 int is_modified_extension_file(const char *filepath);
+int is_modified_extension_buf(const uint8_t *buf, size_t n, const char *filename);
 const char* get_filename(const char* path);
 void safe_filename(char *filename);
+char *dup_str(const char *str);
+char *path_join(const char *prefix, const char *name);
 void create_output_dirs(void);
+int make_dest_path(char *dest_path, size_t size, const char *dest_dir, const char *filename, const char *relative_path);
+int output_category(const char *dest_dir);
+int layout_set(const char *name);
+int layout_open(void);
+void layout_record(const char *dest_path, const char *relative_path, const char *filename);
+void layout_close(void);
+int copy_path(const char *src, const char *dest_path);
+int copy_file_with_digest(const char *src, const char *dest_dir, const char *reason, const char *relative_path, uint8_t digest[32]);
 int copy_file_with_path(const char *src, const char *dest_dir, const char *reason, const char *relative_path);
+#ifndef _WIN32
+int copy_fd_path(int src_fd, const char *src, const char *dest_path);
+int copy_open_file(int src_fd, const char *src, const char *dest_dir, const char *reason, const char *relative_path, uint8_t digest[32]);
+#endif
 int copy_file(const char *src, const char *dest_dir, const char *reason);
-int get_extract_command(const char *filepath, const char *output_dir, char *command, size_t cmd_size);
-int recursive_extract(const char *archive_path, const char *extract_dir, int depth, const char *base_extract_dir, const char *current_path);
-void recursive_process_files(const char *current_dir, const char *base_extract_dir, int depth, const char *current_path);
+void print_copy_stats(void);
+void out_set_fsync(int on);
+FILE *out_fopen(const char *path);
+
+// 输出清单与控制台日志
+void log_set_quiet(int on);
+int log_quiet(void);
+void log_set_sink(tp_log_fn fn, void *ctx);
+#ifdef __GNUC__
+__attribute__((format(printf, 1, 2)))
+#endif
+int log_printf(const char *fmt, ...);
+int manifest_open(const char *path);
+int manifest_enabled(void);
+void manifest_close(void);
+void manifest_add(const char *action, const char *dest_dir, const char *relative_path, const char *filename, const char *dest_path, uint64_t size, const char *type, const uint8_t *digest);
+void report_output(const char *action, const char *reason, const char *src, const char *dest_dir, const char *relative_path, const char *filename, const char *dest_path, uint64_t size, const char *type, const uint8_t *digest);
+
+// 输出筛选（--only / --include / --exclude / --index-only）
+enum { FILTER_WRITE, FILTER_EXPAND, FILTER_INDEX, FILTER_SKIP };
+int filter_set_categories(const char *list);
+int filter_add_glob(const char *pattern, int exclude);
+void filter_set_index_only(int on);
+int filter_decide(const char *dest_dir, const char *path_prefix, const char *filename);
+int filter_skips_name(const char *path_prefix, const char *filename);
+int filter_replayable(void);
+void print_filter_stats(void);
+
+// 运行统计（各阶段耗时、字节数、分类计数、嵌套深度、临时目录占用）
+enum { ST_EXTRACT, ST_STAT, ST_SNIFF, ST_COPY, ST_CLEANUP, ST_STAGES };
+void stats_enable(void);
+int stats_enabled(void);
+uint64_t stats_now(void);
+void stats_time(int stage, uint64_t start);
+void stats_bytes_in(uint64_t n);
+void stats_output(const char *dest_dir, int linked, uint64_t size);
+void stats_depth(int depth);
+void stats_temp(int64_t delta);
+void stats_print(void);
+int stats_write_json(const char *path);
+void out_ring_close(void);
+void out_ring_submit(void);
+void out_ring_disable(void);
+void print_output_stats(void);
+#ifdef _WIN32
+int get_extract_command(int format, const char *filepath, const char *output_dir, char *command, size_t cmd_size);
+#endif
+int recursive_extract(const char *archive_path, const char *archive_name, const char *extract_dir, int depth, const char *base_extract_dir, const char *current_path, const uint8_t *digest);
+uint64_t recursive_process_files(const char *current_dir, const char *base_extract_dir, int depth, const char *current_path);
+int run_archive(const char *tar_path, const char *temp_dir, const char *chain);
 void cleanup_temp_dir(const char *temp_dir);
 
-// ļǷΪCԴļ
+// 线程池
+typedef struct TaskGroup {
+    int pending;            // 已提交但未完成的任务数
+} TaskGroup;
+void pool_init(int nthreads);
+void pool_shutdown(void);
+int pool_parallel(void);
+int pool_threads(void);
+void task_submit(TaskGroup *group, void (*fn)(void *arg), void *arg);
+void task_group_wait(TaskGroup *group);
+
+// 内容哈希与去重
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t  buf[64];
+    size_t   used;
+} Sha256;
+enum { DEDUP_NEW, DEDUP_BUSY, DEDUP_DONE };
+// 一个输出文件，按路径前缀回放压缩包结果时使用
+typedef struct {
+    const char *dest_dir;   // 输出分类目录（字符串常量）
+    const char *reason;
+    char       *relative_path;
+    char       *filename;
+    char       *out_path;
+    uint8_t     digest[32];
+} OutputRecord;
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+void sha256_final(Sha256 *ctx, uint8_t digest[32]);
+int sha256_file(const char *path, uint8_t digest[32]);
+#ifndef _WIN32
+int sha256_fd(int fd, uint8_t digest[32]);
+#endif
+void dedup_enable(void);
+int dedup_enabled(void);
+int dedup_output(const uint8_t *digest, const char *dest_path);
+void dedup_record_output(const char *dest_dir, const char *reason, const char *relative_path, const char *filename, const char *out_path, const uint8_t *digest);
+int dedup_claim_archive(const uint8_t *digest, int depth, const char *new_path, char **first_path);
+void dedup_archive_done(const uint8_t *digest, int depth, int ok);
+OutputRecord *dedup_collect_outputs(const char *prefix, size_t *count);
+void free_output_records(OutputRecord *records, size_t count);
+void dedup_replay(const char *first_path, const char *new_path);
+void print_dedup_stats(void);
+
+// 持久化结果缓存
+int cache_open(const char *dir);
+int cache_enabled(void);
+int cache_replay(const uint8_t *digest, int depth, const char *new_path);
+void cache_store(const uint8_t *digest, int depth, const char *new_path);
+void cache_close(void);
+
+// 输入流与解压器
+typedef struct InStream InStream;
+typedef enum {
+    ARCHIVE_TAR,        // 解码后是 tar 包
+    ARCHIVE_SINGLE      // 解码后是单个文件
+} ArchiveKind;
+typedef struct {
+    const char  *suffix;                    // 文件名后缀
+    size_t       suffix_len;
+    ArchiveKind  kind;
+    InStream  *(*open)(InStream *inner);    // 叠加在下层流上的解压器，NULL 表示无需解压
+} DecoderEntry;
+// 压缩包格式（按内容识别）
+typedef enum {
+    FMT_NONE,           // 不是压缩包
+    FMT_TAR,
+    FMT_GZIP,
+    FMT_BZIP2,
+    FMT_XZ,
+    FMT_ZSTD,
+    FMT_ZIP,
+    FMT_7Z,
+    FMT_RAR
+} ArchiveFormat;
+size_t stream_read_full(InStream *s, void *buf, size_t n);
+void stream_drain(InStream *s);
+void stream_close(InStream *s);
+InStream *file_stream_open(const char *path);
+InStream *input_stream_open(const char *path);
+const DecoderEntry *find_decoder(const char *filename);
+const DecoderEntry *decoder_for_format(int format, const char *filename);
+
+// 外部解压程序（posix_spawn，不经过 shell）
+#ifndef _WIN32
+typedef struct {
+    const char  *argv[8];
+    char         arg_buf[1100];     // 需要拼接的参数（7z 的 -o<dir>、unrar 的 <dir>/）
+    int          to_stdout;         // 结果写到标准输出，由 dec 描述其内容（tar 包或单个文件）
+    DecoderEntry dec;
+} ExtractCommand;
+int get_extract_argv(int format, const char *filepath, const char *output_dir, ExtractCommand *cmd);
+void spawn_init(int max_running);
+pid_t spawn_start(const char *const argv[], int *stdout_fd, uint64_t max_file_size);
+int spawn_wait(pid_t pid, int piped);
+uint64_t budget_child_file_size(void);
+int remove_tree(const char *path);
+uint64_t stage_reserve(const char *archive_path);
+void stage_release(uint64_t reserved, int ok);
+int stage_temp_path(char *path, size_t size, int depth, unsigned long id);
+#endif
+void stage_init(const char *dir, uint64_t max_archive, uint64_t budget);
+void stage_shutdown(void);
+
+// tar 流式读取
+typedef struct TarReader TarReader;
+int sniff_archive(const uint8_t *buf, size_t n, const char *filename);
+int sniff_archive_file(const char *path, const char *filename);
+int extract_entry_with_path(InStream *data, const uint8_t *head, size_t head_len, const char *src_name, const char *dest_dir, const char *reason, const char *relative_path, char *dest_path, size_t dest_size, uint8_t digest[32]);
+void process_entry(InStream *data, const char *member, const char *path_prefix, const char *base_extract_dir, int depth, TaskGroup *group);
+typedef struct Budget Budget;
+int process_tar_stream(InStream *in, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path, Budget *budget);
+int decode_archive(InStream *raw, const DecoderEntry *dec, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path);
+int recursive_extract_stream(InStream *raw, const DecoderEntry *dec, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path);
+
+// 解压配额（单个压缩包和全部合计的解出字节数、成员数、压缩比上限）
+void budget_set(uint64_t max_bytes, uint64_t max_entries, uint64_t max_ratio, uint64_t total_max_bytes, uint64_t total_max_entries);
+void budget_init(Budget *b, InStream *raw, const char *name);
+void budget_attach(Budget *b, InStream *decoded);
+int budget_entry(Budget *b);
+int budget_declare(Budget *b, uint64_t in, uint64_t out);
+int budget_aborted(const Budget *b);
+unsigned long budget_aborted_archives(void);
+unsigned long budget_aborted_here(void);
+void print_budget_stats(void);
+
+// 递归任务
+typedef struct EntryTask EntryTask;
+EntryTask *entry_task_new(const char *path, const char *name, const char *base_extract_dir, const char *current_path, int depth, const uint8_t *digest);
+void entry_task_submit(TaskGroup *group, void (*fn)(void *arg), const char *path, const char *name, const char *base_extract_dir,
+                       const char *current_path, int depth, const uint8_t *digest, int dirfd, uint64_t *temp_bytes);
+void extract_task(void *arg);
+void extract_temp_task(void *arg);
+
+// 检查文件是否为C源文件
 int is_c_file(const char *filename) {
     const char *ext = strrchr(filename, '.');
     if (ext != NULL) {
@@ -49,7 +294,7 @@ int is_c_file(const char *filename) {
     return 0;
 }
 
-// ļǷΪѹ
+// 检查文件是否为压缩包
 int is_archive_file(const char *filename) {
     const char *ext = strrchr(filename, '.');
     if (ext != NULL) {
@@ -60,522 +305,6359 @@ int is_archive_file(const char *filename) {
                 strcmp(ext, ".zip") == 0 ||
                 strcmp(ext, ".rar") == 0 ||
                 strcmp(ext, ".7z") == 0 ||
+                strcmp(ext, ".zst") == 0 ||
                 strcmp(ext, ".tgz") == 0 ||
                 strcmp(ext, ".tbz2") == 0 ||
-                strcmp(ext, ".txz") == 0);
+                strcmp(ext, ".txz") == 0 ||
+                strcmp(ext, ".tzst") == 0);
     }
 
     return 0;
 }
 
-// ļչѡʵĽѹ
-int get_extract_command(const char *filepath, const char *output_dir, char *command, size_t cmd_size) {
+// 根据文件扩展名选择合适的解压命令
+#ifdef _WIN32
+// 按识别出的格式生成外部解压命令（tar / gzip / bzip2 / xz 已在进程内解码，这里只剩需要外部命令的格式）
+int get_extract_command(int format, const char *filepath, const char *output_dir, char *command, size_t cmd_size) {
     const char *filename = get_filename(filepath);
     const char *ext = strrchr(filename, '.');
 
-    if (!ext) return 0;
-
-    // 鸴չ
-    const char *second_ext = NULL;
-    if (ext > filename) {
-        const char *temp = ext - 1;
-        while (temp > filename && *temp != '.') temp--;
-        if (*temp == '.') second_ext = temp;
-    }
-
-    // չ
-    if (second_ext && strncmp(second_ext, ".tar.gz", 7) == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "tar -xzf \"%s\" -C \"%s\" 2>nul", filepath, output_dir);
-#else
-        snprintf(command, cmd_size, "tar -xzf \"%s\" -C \"%s\" 2>/dev/null", filepath, output_dir);
-#endif
-        return 1;
-    }
-    else if (second_ext && strncmp(second_ext, ".tar.bz2", 8) == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "tar -xjf \"%s\" -C \"%s\" 2>nul", filepath, output_dir);
-#else
-        snprintf(command, cmd_size, "tar -xjf \"%s\" -C \"%s\" 2>/dev/null", filepath, output_dir);
-#endif
-        return 1;
-    }
-    else if (second_ext && strncmp(second_ext, ".tar.xz", 7) == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "tar -xJf \"%s\" -C \"%s\" 2>nul", filepath, output_dir);
-#else
-        snprintf(command, cmd_size, "tar -xJf \"%s\" -C \"%s\" 2>/dev/null", filepath, output_dir);
-#endif
+#ifndef HAVE_ZSTD
+    if (format == FMT_ZSTD) {
+        // 没有链接 libzstd 时退回 zstd 命令；按扩展名判断里面是不是 tar 包
+        size_t len = strlen(filename);
+        if ((len >= 8 && strcmp(filename + len - 8, ".tar.zst") == 0) || (ext && strcmp(ext, ".tzst") == 0)) {
+            snprintf(command, cmd_size, "zstd -d -q -c \"%s\" | tar -xf - -C \"%s\" 2>nul", filepath, output_dir);
+            return 1;
+        }
+        // 解出的文件去掉 .zst 后缀，避免被再次当作压缩包；改过名的保持原名
+        int name_len = (ext && strcmp(ext, ".zst") == 0) ? (int)(ext - filename) : (int)len;
+        snprintf(command, cmd_size, "zstd -d -q -c \"%s\" > \"%s\\%.*s\" 2>nul", filepath, output_dir, name_len, filename);
         return 1;
     }
-    // һչ
-    else if (strcmp(ext, ".tar") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "tar -xf \"%s\" -C \"%s\" 2>nul", filepath, output_dir);
 #else
-        snprintf(command, cmd_size, "tar -xf \"%s\" -C \"%s\" 2>/dev/null", filepath, output_dir);
+    (void)ext;
 #endif
+    if (format == FMT_ZIP) {
+        snprintf(command, cmd_size, "powershell -command \"Expand-Archive -Path '%s' -DestinationPath '%s' -Force\" 2>nul", filepath, output_dir);
         return 1;
     }
-    else if (strcmp(ext, ".gz") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "gzip -d -c \"%s\" > \"%s\\%s\" 2>nul", filepath, output_dir, filename);
-#else
-        snprintf(command, cmd_size, "gzip -d -c \"%s\" > \"%s/%s\" 2>/dev/null", filepath, output_dir, filename);
-#endif
+    else if (format == FMT_7Z) {
+        snprintf(command, cmd_size, "7z x \"%s\" -o\"%s\" -y 2>nul", filepath, output_dir);
         return 1;
     }
-    else if (strcmp(ext, ".bz2") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "bzip2 -d -c \"%s\" > \"%s\\%s\" 2>nul", filepath, output_dir, filename);
-#else
-        snprintf(command, cmd_size, "bzip2 -d -c \"%s\" > \"%s/%s\" 2>/dev/null", filepath, output_dir, filename);
-#endif
+    else if (format == FMT_RAR) {
+        snprintf(command, cmd_size, "unrar x \"%s\" \"%s\\\" -y 2>nul", filepath, output_dir);
         return 1;
     }
-    else if (strcmp(ext, ".xz") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "xz -d -c \"%s\" > \"%s\\%s\" 2>nul", filepath, output_dir, filename);
+
+    return 0;
+}
 #else
-        snprintf(command, cmd_size, "xz -d -c \"%s\" > \"%s/%s\" 2>/dev/null", filepath, output_dir, filename);
-#endif
+// 按识别出的格式生成外部解压程序的参数（不经过 shell）。
+// 能把结果写到标准输出的（zstd -c）直接把输出流交给分类流程，不落临时目录
+int get_extract_argv(int format, const char *filepath, const char *output_dir, ExtractCommand *cmd) {
+    const char *filename = get_filename(filepath);
+    const char *ext = strrchr(filename, '.');
+    const char **argv = cmd->argv;
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->dec.suffix = "";
+
+#ifndef HAVE_ZSTD
+    if (format == FMT_ZSTD) {
+        // 没有链接 libzstd 时退回 zstd 命令；按扩展名判断里面是不是 tar 包
+        size_t len = strlen(filename);
+        argv[0] = "zstd"; argv[1] = "-d"; argv[2] = "-q"; argv[3] = "-c"; argv[4] = filepath;
+        cmd->to_stdout = 1;
+        if ((len >= 8 && strcmp(filename + len - 8, ".tar.zst") == 0) || (ext && strcmp(ext, ".tzst") == 0)) {
+            cmd->dec.kind = ARCHIVE_TAR;
+        } else {
+            // 解出的文件去掉 .zst 后缀，避免被再次当作压缩包；改过名的保持原名
+            cmd->dec.kind = ARCHIVE_SINGLE;
+            if (ext && strcmp(ext, ".zst") == 0) cmd->dec.suffix_len = 4;
+        }
         return 1;
     }
-    else if (strcmp(ext, ".zip") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "powershell -command \"Expand-Archive -Path '%s' -DestinationPath '%s' -Force\" 2>nul", filepath, output_dir);
 #else
-        snprintf(command, cmd_size, "unzip -q \"%s\" -d \"%s\" 2>/dev/null", filepath, output_dir);
+    (void)ext;
 #endif
+    if (format == FMT_ZIP) {
+        argv[0] = "unzip"; argv[1] = "-q"; argv[2] = filepath; argv[3] = "-d"; argv[4] = output_dir;
         return 1;
     }
-    else if (strcmp(ext, ".7z") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "7z x \"%s\" -o\"%s\" -y 2>nul", filepath, output_dir);
-#else
-        snprintf(command, cmd_size, "7z x \"%s\" -o\"%s\" -y 2>/dev/null", filepath, output_dir);
-#endif
+    else if (format == FMT_7Z) {
+        // 7z x -so 会把所有成员首尾相接且不带文件名，多文件的包无法分类，仍解到目录
+        snprintf(cmd->arg_buf, sizeof(cmd->arg_buf), "-o%s", output_dir);
+        argv[0] = "7z"; argv[1] = "x"; argv[2] = filepath; argv[3] = cmd->arg_buf; argv[4] = "-y";
         return 1;
     }
-    else if (strcmp(ext, ".rar") == 0) {
-#ifdef _WIN32
-        snprintf(command, cmd_size, "unrar x \"%s\" \"%s\\\" -y 2>nul", filepath, output_dir);
-#else
-        snprintf(command, cmd_size, "unrar x \"%s\" \"%s/\" -y 2>/dev/null", filepath, output_dir);
-#endif
+    else if (format == FMT_RAR) {
+        snprintf(cmd->arg_buf, sizeof(cmd->arg_buf), "%s/", output_dir);
+        argv[0] = "unrar"; argv[1] = "x"; argv[2] = filepath; argv[3] = cmd->arg_buf; argv[4] = "-y";
         return 1;
     }
 
     return 0;
 }
+#endif
+
+/*========== 1. 魔数表定义 ==========*/
+#define MAGIC_HEAD_SIZE 512  // 判断类型时读取的头部字节数（一个 tar 块）
 
-/*========== 1. ħ ==========*/
 typedef struct {
-    const uint8_t sig[16];   // ħֽڣ㲹 0
-    uint8_t       sig_len;   // Ч
-    const char   *exts[8];   // չ NULL β 1  NULL  øʽͨչ
+    const uint8_t sig[16];   // 魔数字节（不足补 0）
+    uint8_t       sig_len;   // 有效长度
+    const char   *exts[8];   // 允许扩展名（最后用 NULL 结尾）。若第 1 个就是 NULL → 该格式通常无扩展名
+    uint8_t       format;    // 压缩包格式（ArchiveFormat），FMT_NONE 表示不是压缩包
+    uint8_t       sub_off;   // 二级魔数的偏移（RIFF 子类型、ftyp box 等）
+    uint8_t       sub_len;   // 二级魔数长度，0 表示没有
+    const uint8_t sub[8];
 } MagicEntry;
 
-/* ֻҪҪĸʽ׷ӽ */
+/* 只要把需要的格式追加进来即可；同一首字节下魔数越长越先匹配 */
 static const MagicEntry magic_tbl[] = {
-    /* ͼƬ */
-    {{0x89,0x50,0x4E,0x47},                  4, {".png", NULL}},
-    {{0xFF,0xD8,0xFF},                       3, {".jpg",".jpeg", NULL}},
-    {{0x47,0x49,0x46,0x38},                  4, {".gif", NULL}},
-    {{0x42,0x4D},                            2, {".bmp", NULL}},
-    {{0x49,0x49,0x2A,0x00},                  4, {".tif",".tiff", NULL}},   // TIFF little?endian
-    {{0x4D,0x4D,0x00,0x2A},                  4, {".tif",".tiff", NULL}},   // TIFF big?endian
-    {{0x52,0x49,0x46,0x46},                  4, {".webp" /* ٶж WEBP chunk */, NULL}},
-
-    /* Ƶ / Ƶ  */
-    {{0x52,0x49,0x46,0x46},                  4, {".wav",".avi",".webp", NULL}}, // RIFF ܶʽ
-    {{0x00,0x00,0x00,0x18,0x66,0x74,0x79,0x70}, 8, {".mp4",".mov",".m4a",".m4v", NULL}},
-    {{0x1A,0x45,0xDF,0xA3},                  4, {".mkv",".webm", NULL}},   // Matroska / WebM
-    {{0xFF,0xFB},                            2, {".mp3", NULL}},           //  ID3 ж
-    {{0x4F,0x67,0x67,0x53},                  4, {".ogg",".oga", NULL}},
-    {{0x66,0x4C,0x61,0x43},                  4, {".flac", NULL}},
-
-    /* ĵ /  */
-    {{0x25,0x50,0x44,0x46},                  4, {".pdf", NULL}},
-    {{0x50,0x4B,0x03,0x04},                  4, {".zip",".docx",".xlsx",".pptx",".jar",".apk", NULL}},
-    {{0xD0,0xCF,0x11,0xE0,0xA1,0xB1,0x1A,0xE1}, 8, {".doc",".xls",".ppt",".msi", NULL}}, // ɰ OLE
-
-    /* ѹ / 鵵 */
-    {{0x1F,0x8B,0x08},                       3, {".gz", NULL}},
-    {{0x42,0x5A,0x68},                       3, {".bz2", NULL}},
-    {{0xFD,0x37,0x7A,0x58,0x5A,0x00},        6, {".xz", NULL}},
-    {{0x28,0xB5,0x2F,0xFD},                  4, {".zst", NULL}},
-    {{0x37,0x7A,0xBC,0xAF,0x27,0x1C},        6, {".7z", NULL}},
-    {{0x52,0x61,0x72,0x21,0x1A,0x07},        6, {".rar", NULL}},           // RAR v4
-    {{0x52,0x61,0x72,0x21,0x1A,0x07,0x00},   7, {".rar", NULL}},           // RAR v5
-
-    /* ִ /  */
-    {{0x7F,0x45,0x4C,0x46},                  4, {".so", NULL}},                   // ELF, ͨչ
-    {{0x4D,0x5A},                            2, {".exe",".dll",".sys",".ocx",".scr",".drv", NULL}}, // PE (DOS MZ)
-
-    /*  */
-    {{0}, 0, {NULL}}
-};
+    /* 图片 */
+    { .sig = {0x89,0x50,0x4E,0x47}, .sig_len = 4, .exts = {".png", NULL} },
+    { .sig = {0xFF,0xD8,0xFF}, .sig_len = 3, .exts = {".jpg",".jpeg", NULL} },
+    { .sig = {0x47,0x49,0x46,0x38}, .sig_len = 4, .exts = {".gif", NULL} },
+    { .sig = {0x42,0x4D}, .sig_len = 2, .exts = {".bmp", NULL} },
+    { .sig = {0x49,0x49,0x2A,0x00}, .sig_len = 4, .exts = {".tif",".tiff", NULL} },   // TIFF little-endian
+    { .sig = {0x4D,0x4D,0x00,0x2A}, .sig_len = 4, .exts = {".tif",".tiff", NULL} },   // TIFF big-endian
+    { .sig = {0x52,0x49,0x46,0x46}, .sig_len = 4, .exts = {".webp", NULL}, .sub_off = 8, .sub_len = 4, .sub = {'W','E','B','P'} },
 
-/*========== 2. ʵ ==========*/
-int is_modified_extension_file(const char *filepath)
-{
-    /* ǰ 16 ֽ */
-    uint8_t buf[16] = {0};
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp) return 0;
-    size_t n = fread(buf, 1, sizeof(buf), fp);
-    fclose(fp);
-    if (n == 0) return 0;
-
-    /* õǰչ㣩Ϊ NULL */
-    const char *ext = strrchr(filepath, '.');
+    /* 音频 / 视频 容器 */
+    { .sig = {0x52,0x49,0x46,0x46}, .sig_len = 4, .exts = {".wav", NULL}, .sub_off = 8, .sub_len = 4, .sub = {'W','A','V','E'} },   // RIFF 按子类型区分
+    { .sig = {0x52,0x49,0x46,0x46}, .sig_len = 4, .exts = {".avi", NULL}, .sub_off = 8, .sub_len = 4, .sub = {'A','V','I',' '} },
+    { .sig = {0x00}, .sig_len = 1, .exts = {".mp4",".mov",".m4a",".m4v", NULL}, .sub_off = 4, .sub_len = 4, .sub = {'f','t','y','p'} },   // 任意大小的 ftyp box
+    { .sig = {0x1A,0x45,0xDF,0xA3}, .sig_len = 4, .exts = {".mkv",".webm", NULL} },   // Matroska / WebM
+    { .sig = {0x49,0x44,0x33}, .sig_len = 3, .exts = {".mp3", NULL} },   // ID3 标签开头的 MP3
+    { .sig = {0xFF,0xFB}, .sig_len = 2, .exts = {".mp3", NULL} },   // MPEG-1 Layer III 帧头
+    { .sig = {0xFF,0xF3}, .sig_len = 2, .exts = {".mp3", NULL} },   // MPEG-2 Layer III
+    { .sig = {0xFF,0xF2}, .sig_len = 2, .exts = {".mp3", NULL} },
+    { .sig = {0x4F,0x67,0x67,0x53}, .sig_len = 4, .exts = {".ogg",".oga", NULL} },
+    { .sig = {0x66,0x4C,0x61,0x43}, .sig_len = 4, .exts = {".flac", NULL} },
 
-    /* ħ */
-    for (int i = 0; magic_tbl[i].sig_len; ++i)
-    {
-        const MagicEntry *m = &magic_tbl[i];
-        if (n < m->sig_len) continue;
-        if (memcmp(buf, m->sig, m->sig_len) != 0) continue;   // ħƥ
+    /* 文档 / 数据 */
+    { .sig = {0x25,0x50,0x44,0x46}, .sig_len = 4, .exts = {".pdf", NULL} },
+    { .sig = {0x50,0x4B,0x03,0x04}, .sig_len = 4, .exts = {".zip",".docx",".xlsx",".pptx",".jar",".apk", NULL}, .format = FMT_ZIP },
+    { .sig = {0xD0,0xCF,0x11,0xE0,0xA1,0xB1,0x1A,0xE1}, .sig_len = 8, .exts = {".doc",".xls",".ppt",".msi", NULL} },   // 旧版 OLE
 
-        /*== ħƥɹ ==*/
+    /* 压缩 / 归档 */
+    { .sig = {0x1F,0x8B,0x08}, .sig_len = 3, .exts = {".gz",".tgz", NULL}, .format = FMT_GZIP },
+    { .sig = {0x42,0x5A,0x68}, .sig_len = 3, .exts = {".bz2",".tbz2", NULL}, .format = FMT_BZIP2 },
+    { .sig = {0xFD,0x37,0x7A,0x58,0x5A,0x00}, .sig_len = 6, .exts = {".xz",".txz", NULL}, .format = FMT_XZ },
+    { .sig = {0x28,0xB5,0x2F,0xFD}, .sig_len = 4, .exts = {".zst",".tzst", NULL}, .format = FMT_ZSTD },
+    { .sig = {0x37,0x7A,0xBC,0xAF,0x27,0x1C}, .sig_len = 6, .exts = {".7z", NULL}, .format = FMT_7Z },
+    { .sig = {0x52,0x61,0x72,0x21,0x1A,0x07,0x00}, .sig_len = 7, .exts = {".rar", NULL}, .format = FMT_RAR },   // RAR v4
+    { .sig = {0x52,0x61,0x72,0x21,0x1A,0x07,0x01,0x00}, .sig_len = 8, .exts = {".rar", NULL}, .format = FMT_RAR },   // RAR v5
 
-        /* 1) øʽͨչ */
-        if (m->exts[0] == NULL)
-            return (ext != NULL);   // չ ? 
+    /* 可执行 / 库 */
+    { .sig = {0x7F,0x45,0x4C,0x46}, .sig_len = 4, .exts = {".so", NULL} },   // ELF, 通常无扩展
+    { .sig = {0x4D,0x5A}, .sig_len = 2, .exts = {".exe",".dll",".sys",".ocx",".scr",".drv", NULL} },   // PE (DOS MZ)
 
-        /* 2) ԭӦչ */
-        if (ext == NULL) return 1;  // ûչ ? 
+    /* 结束标记 */
+    { .sig_len = 0 }
+};
 
-        /* 3) Ƿ */
-        for (int k = 0; m->exts[k]; ++k) {
-            if (extcasecmp(ext, m->exts[k]) == 0)
-                return 0;           // չ
-        }
-        return 1;                   //  ? 
-    }
+#define MAGIC_COUNT (sizeof(magic_tbl) / sizeof(magic_tbl[0]) - 1)
 
-    /* ûҵӦħ => жϣΪ 0 */
-    return 0;
-}
+const MagicEntry *magic_lookup(const uint8_t *buf, size_t n);
+const char *magic_type_name(const uint8_t *head, size_t n);
 
-// Ŀ¼
-void create_output_dirs() {
-    my_mkdir("result");
-    my_mkdir("result/extracted_c_files");
-    my_mkdir("result/extracted_archives");
-    my_mkdir("result/extracted_modified_files");
-    my_mkdir("result/extracted_other_files");  // ļĿ¼
-}
+/*========== 2. 函数实现 ==========*/
+/* 首字节分派表：magic_order 中 [magic_bucket[b], magic_bucket[b+1]) 为首字节为 b 的表项，
+   同一桶内按魔数总长度从长到短排列。表在首次使用时由 magic_tbl 生成一次 */
+static uint16_t magic_bucket[257];
+static uint8_t  magic_order[MAGIC_COUNT];
 
-// ȡļƽ̨
-const char* get_filename(const char* path) {
-    const char* filename = strrchr(path, '/');
-    if (!filename) filename = strrchr(path, '\\');
-    return filename ? filename + 1 : path;
-}
+static void magic_index_build(void)
+{
+    for (size_t i = 0; i < MAGIC_COUNT; ++i)
+        magic_bucket[magic_tbl[i].sig[0] + 1]++;
+    for (int b = 0; b < 256; ++b)
+        magic_bucket[b + 1] += magic_bucket[b];
 
-// ȫļ滻·ָΪָ
-void safe_filename(char *filename) {
-    for (int i = 0; filename[i]; i++) {
-        if (filename[i] == '/' || filename[i] == '\\') {
-            filename[i] = '@';  // ʹ@Ϊ·ָ
-        } else if (filename[i] == ':' || filename[i] == '*' ||
-                   filename[i] == '?' || filename[i] == '"' ||
-                   filename[i] == '<' || filename[i] == '>' || filename[i] == '|') {
-            filename[i] = '#';  // ַ#
+    uint16_t fill[256];
+    memcpy(fill, magic_bucket, sizeof(fill));
+    for (size_t i = 0; i < MAGIC_COUNT; ++i) {
+        /* 插入排序：桶内更长（更具体）的魔数排在前面，等长时保持表内顺序 */
+        int b = magic_tbl[i].sig[0];
+        int len = magic_tbl[i].sig_len + magic_tbl[i].sub_len;
+        uint16_t k = fill[b]++;
+        while (k > magic_bucket[b]) {
+            const MagicEntry *prev = &magic_tbl[magic_order[k - 1]];
+            if (prev->sig_len + prev->sub_len >= len) break;
+            magic_order[k] = magic_order[k - 1];
+            --k;
         }
+        magic_order[k] = (uint8_t)i;
     }
 }
 
-// ļָĿ¼·ǰ׺
-int copy_file_with_path(const char *src, const char *dest_dir, const char *reason, const char *relative_path) {
-    char dest_path[2048];
-    char safe_path[1024];
-    const char *filename = get_filename(src);
+#ifndef _WIN32
+static pthread_once_t magic_index_once = PTHREAD_ONCE_INIT;
+#else
+static int magic_index_ready = 0;
+#endif
 
-    // ȫ·ǰ׺
-    if (relative_path && strlen(relative_path) > 0) {
-        strncpy(safe_path, relative_path, sizeof(safe_path) - 1);
-        safe_path[sizeof(safe_path) - 1] = '\0';
-        safe_filename(safe_path);
-        snprintf(dest_path, sizeof(dest_path), "%s/[%s]%s", dest_dir, safe_path, filename);
-    } else {
-        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest_dir, filename);
+/* 按头部字节查找格式，找不到返回 NULL */
+const MagicEntry *magic_lookup(const uint8_t *buf, size_t n)
+{
+    if (n == 0) return NULL;
+#ifndef _WIN32
+    pthread_once(&magic_index_once, magic_index_build);
+#else
+    if (!magic_index_ready) {
+        magic_index_build();
+        magic_index_ready = 1;
     }
+#endif
 
-    FILE *src_file = fopen(src, "rb");
-    if (!src_file) {
-        printf("Error: Unable to open the source file, %s\n", src);
-        return 0;
+    for (int k = magic_bucket[buf[0]]; k < magic_bucket[buf[0] + 1]; ++k)
+    {
+        const MagicEntry *m = &magic_tbl[magic_order[k]];
+        if (n < m->sig_len || memcmp(buf, m->sig, m->sig_len) != 0) continue;
+        if (m->sub_len && (n < (size_t)m->sub_off + m->sub_len || memcmp(buf + m->sub_off, m->sub, m->sub_len) != 0))
+            continue;
+        return m;
     }
+    return NULL;
+}
 
-    FILE *dest_file = fopen(dest_path, "wb");
-    if (!dest_file) {
-        printf("Error: Unable to open the source file, %s\n", dest_path);
-        fclose(src_file);
-        return 0;
-    }
+int is_modified_extension_file(const char *filepath)
+{
+    /* 读文件头 */
+    uint8_t buf[MAGIC_HEAD_SIZE] = {0};
+    FILE *fp = fopen(filepath, "rb");
+    if (!fp) return 0;
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
 
-    char buffer[4096];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
-        fwrite(buffer, 1, bytes, dest_file);
+    return is_modified_extension_buf(buf, n, filepath);
+}
+
+/* 对已读到的头部字节做判断（流式解包时不必再打开文件） */
+int is_modified_extension_buf(const uint8_t *buf, size_t n, const char *filename)
+{
+    const MagicEntry *m = magic_lookup(buf, n);
+
+    /* 没找到对应魔数 => 不判断，视为正常 0 */
+    if (!m) return 0;
+
+    /* 拿当前扩展名（包含点），可能为 NULL */
+    const char *ext = strrchr(filename, '.');
+
+    /* 1) 该格式通常无扩展名 */
+    if (m->exts[0] == NULL)
+        return (ext != NULL);   // 有扩展名 → 被改名
+
+    /* 2) 原本应该有扩展名 */
+    if (ext == NULL) return 1;  // 没扩展名 → 被改名
+
+    /* 3) 检查是否在允许集合里 */
+    for (int k = 0; m->exts[k]; ++k) {
+        if (extcasecmp(ext, m->exts[k]) == 0)
+            return 0;           // 正常扩展名
     }
+    return 1;                   // 不在允许集合 → 被改名
+}
 
-    fclose(src_file);
-    fclose(dest_file);
+/* ---- 输出清单与控制台日志 ---- */
+// 每个输出文件一行 JSON（--manifest FILE）：所在路径链、原文件名、分类、大小、识别出的类型、SHA-256、输出路径。
+// 各线程先在栈上拼好一整行，再在锁内写入带 1 MiB 缓冲的文件。--quiet 时不再逐个文件打印
+#define MANIFEST_BUF_SIZE (1 << 20)
 
-    printf("Extracted %s: %s -> %s\n", reason, src, dest_path);
-    return 1;
+// 输出分类（缓存中只存编号，清单中写 key）
+static const struct {
+    const char *dest_dir;
+    const char *reason;
+    const char *key;
+} output_categories[] = {
+    { "result/extracted_c_files",       "C源文件",         "c_source" },
+    { "result/extracted_archives",      "压缩包",          "archive" },
+    { "result/extracted_modified_files", "修改扩展名的文件", "modified_extension" },
+    { "result/extracted_other_files",   "其他文件",        "other" },
+};
+#define OUTPUT_CATEGORIES ((int)(sizeof(output_categories) / sizeof(output_categories[0])))
+
+// 输出分类的下标，不认识的目录归入最后一类
+int output_category(const char *dest_dir) {
+    int cat = 0;
+    while (cat < OUTPUT_CATEGORIES - 1 && strcmp(dest_dir, output_categories[cat].dest_dir) != 0) cat++;
+    return cat;
 }
 
-// ļָĿ¼
-int copy_file(const char *src, const char *dest_dir, const char *reason) {
-    return copy_file_with_path(src, dest_dir, reason, NULL);
+static struct {
+    int   quiet;
+    FILE *fp;
+    char *buf;
+    unsigned long rows;
+    unsigned long dropped;  // 内存不足而没能写入的行
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} g_manifest = {
+    0, NULL, NULL, 0, 0,
+#ifndef _WIN32
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+void log_set_quiet(int on) {
+    g_manifest.quiet = on;
 }
 
-// ݹѹѹ
-int recursive_extract(const char *archive_path, const char *extract_dir, int depth, const char *base_extract_dir, const char *current_path) {
-    if (depth > 10) {  // ֹ޵ݹ飬Ϊ10
-        printf("Warning: Maximum recursion depth reached, stopping decompression. %s\n", archive_path);
-        return 0;
-    }
+// 诊断信息（错误、警告、每个文件的日志）默认写到标准输出；库调用方提供了 log 回调时逐行交给它，不含换行
+static struct {
+    tp_log_fn fn;
+    void     *ctx;
+} g_log;
 
-    printf("decompressing (depth %d): %s\n", depth, get_filename(archive_path));
+static __thread int tls_in_callback = 0;    // 当前线程正在执行库调用方的 log / visit 回调
 
-    // ΪǰѹʱѹĿ¼
-    char temp_extract_dir[1024];
-    snprintf(temp_extract_dir, sizeof(temp_extract_dir), "%s_temp_%d", extract_dir, depth);
-    my_mkdir(temp_extract_dir);
+void log_set_sink(tp_log_fn fn, void *ctx) {
+    g_log.fn = fn;
+    g_log.ctx = ctx;
+}
 
-    // ȡѹ
-    char extract_command[1024];
-    if (!get_extract_command(archive_path, temp_extract_dir, extract_command, sizeof(extract_command))) {
-        printf("Waring: Can not decompress the file: %s\n", archive_path);
-        cleanup_temp_dir(temp_extract_dir);
-        return 0;
+int log_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (!g_log.fn) {
+        int n = vprintf(fmt, ap);
+        va_end(ap);
+        return n;
     }
 
-    // ִнѹ
-    int result = system(extract_command);
-    if (result != 0) {
-        printf("Waring: decompress failed %s\n", archive_path);
-        cleanup_temp_dir(temp_extract_dir);
-        return 0;
+    // 一般放得进栈上的缓冲区，很长的路径换成堆缓冲区重新格式化
+    char stack_line[1024];
+    char *line = stack_line;
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(stack_line, sizeof(stack_line), fmt, ap);
+    if (n >= (int)sizeof(stack_line) && (line = malloc((size_t)n + 1)) != NULL) {
+        vsnprintf(line, (size_t)n + 1, fmt, again);
+    } else if (!line) {
+        line = stack_line;          // 内存不足时交出截断的一行
     }
+    va_end(again);
+    va_end(ap);
+    if (n < 0) return n;
 
-    // ǰ·ǰ׺
-    char new_path[1024];
-    if (current_path && strlen(current_path) > 0) {
-        snprintf(new_path, sizeof(new_path), "%s/%s", current_path, get_filename(archive_path));
-    } else {
-        strncpy(new_path, get_filename(archive_path), sizeof(new_path) - 1);
-        new_path[sizeof(new_path) - 1] = '\0';
-    }
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+    tls_in_callback++;
+    g_log.fn(g_log.ctx, line);
+    tls_in_callback--;
+    if (line != stack_line) free(line);
+    return n;
+}
 
-    // ѹļ
-    recursive_process_files(temp_extract_dir, base_extract_dir, depth + 1, new_path);
+int log_quiet(void) {
+    return g_manifest.quiet;
+}
 
-    // ʱĿ¼
-    cleanup_temp_dir(temp_extract_dir);
+int manifest_open(const char *path) {
+    g_manifest.fp = fopen(path, "wb");
+    if (!g_manifest.fp) {
+        log_printf("Error: Unable to open the manifest file, %s\n", path);
+        return 0;
+    }
+    g_manifest.buf = malloc(MANIFEST_BUF_SIZE);
+    if (g_manifest.buf) setvbuf(g_manifest.fp, g_manifest.buf, _IOFBF, MANIFEST_BUF_SIZE);
     return 1;
 }
 
-// ݹ鴦ļһѹ
-void recursive_process_files(const char *current_dir, const char *base_extract_dir, int depth, const char *current_path) {
-#ifdef _WIN32
-    char search_path[1024];
-    snprintf(search_path, sizeof(search_path), "%s\\*", current_dir);
+int manifest_enabled(void) {
+    return g_manifest.fp != NULL;
+}
 
-    struct _finddata_t file_info;
-    intptr_t handle = _findfirst(search_path, &file_info);
+void manifest_close(void) {
+    if (!g_manifest.fp) return;
+    if (fclose(g_manifest.fp) != 0) log_printf("Waring: Unable to write the manifest file\n");
+    free(g_manifest.buf);
+    g_manifest.fp = NULL;
+    g_manifest.buf = NULL;
+    log_printf("- Manifest: %lu entries\n", g_manifest.rows);
+    if (g_manifest.dropped) log_printf("Waring: %lu manifest entries were dropped (out of memory)\n", g_manifest.dropped);
+}
 
-    if (handle == -1) {
-        return;
-    }
+static int tar_checksum_ok(const uint8_t *hdr);
 
-    do {
-        if (strcmp(file_info.name, ".") == 0 || strcmp(file_info.name, "..") == 0) {
-            continue;
-        }
+// 头部字节对应的类型名（魔数表中的第一个扩展名，去掉点），不认识时返回 NULL
+const char *magic_type_name(const uint8_t *head, size_t n) {
+    if (n >= 512 && head[0] != '\0' && tar_checksum_ok(head)) return "tar";
+    const MagicEntry *m = magic_lookup(head, n);
+    if (!m || !m->exts[0]) return NULL;
+    return m->exts[0] + 1;
+}
 
-        char filepath[1024];
-        snprintf(filepath, sizeof(filepath), "%s\\%s", current_dir, file_info.name);
+// 按格式追加，写满时截断
+static size_t row_append(char *out, size_t pos, size_t cap, const char *fmt, ...) {
+    if (pos >= cap) return cap;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out + pos, cap - pos, fmt, ap);
+    va_end(ap);
+    if (n < 0) return pos;
+    return pos + (size_t)n < cap ? pos + (size_t)n : cap;
+}
 
-        // ·һεݹ
-        char relative_path[1024];
-        if (current_path && strlen(current_path) > 0) {
-            snprintf(relative_path, sizeof(relative_path), "%s/%s", current_path, file_info.name);
+// 追加一个 JSON 字符串（控制字符和引号转义，其余字节原样输出）
+static size_t json_string(char *out, size_t pos, size_t cap, const char *s) {
+    if (pos < cap) out[pos++] = '"';
+    for (; s && *s && pos + 7 < cap; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[pos++] = '\\';
+            out[pos++] = (char)c;
+        } else if (c < 0x20) {
+            pos = row_append(out, pos, cap, "\\u%04x", c);
         } else {
-            strncpy(relative_path, file_info.name, sizeof(relative_path) - 1);
-            relative_path[sizeof(relative_path) - 1] = '\0';
+            out[pos++] = (char)c;
         }
+    }
+    if (pos < cap) out[pos++] = '"';
+    return pos;
+}
 
-        // ǰ·ǰ׺ǰļ
-        char path_prefix[1024];
-        if (current_path && strlen(current_path) > 0) {
-            strncpy(path_prefix, current_path, sizeof(path_prefix) - 1);
-            path_prefix[sizeof(path_prefix) - 1] = '\0';
-        } else {
-            path_prefix[0] = '\0';
-        }
+// 向清单写一行。action 为 "Extracted"、"Linked"、"Cached"（从缓存复制）或 "Indexed"（只记录不写出，dest_path 为 NULL）；
+// size 为 UINT64_MAX 时从输出文件取；type / digest 未知时为 NULL
+void manifest_add(const char *action, const char *dest_dir, const char *relative_path, const char *filename,
+                  const char *dest_path, uint64_t size, const char *type, const uint8_t *digest) {
+    if (!g_manifest.fp) return;
 
-        if (file_info.attrib & _A_SUBDIR) {
-            // ݹ鴦Ŀ¼
-            recursive_process_files(filepath, base_extract_dir, depth, relative_path);
+    if (size == UINT64_MAX) {
+        struct stat st;
+        size = dest_path && stat(dest_path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+    const char *category = "";
+    for (int c = 0; c < OUTPUT_CATEGORIES; c++) {
+        if (strcmp(dest_dir, output_categories[c].dest_dir) == 0) category = output_categories[c].key;
+    }
+
+    // 一般放得进栈上的缓冲区；路径很长时换成足够大的堆缓冲区重新拼，不丢行
+    char stack_row[8192];
+    char *row = stack_row;
+    size_t cap = sizeof(stack_row);
+    size_t pos;
+    for (;;) {
+        pos = row_append(row, 0, cap, "{\"chain\":");
+        pos = json_string(row, pos, cap, relative_path ? relative_path : "");
+        pos = row_append(row, pos, cap, ",\"name\":");
+        pos = json_string(row, pos, cap, filename);
+        pos = row_append(row, pos, cap, ",\"category\":\"%s\",\"size\":%llu,\"type\":", category,
+                                (unsigned long long)size);
+        if (type) pos = json_string(row, pos, cap, type);
+        else pos = row_append(row, pos, cap, "null");
+        pos = row_append(row, pos, cap, ",\"sha256\":");
+        if (digest) {
+            char hex[65];
+            for (int i = 0; i < 32; i++) snprintf(hex + i * 2, 3, "%02x", digest[i]);
+            pos = row_append(row, pos, cap, "\"%s\"", hex);
         } else {
-            // ļ
-            if (is_archive_file(file_info.name)) {
-                // ȡѹarchivesĿ¼
-                copy_file_with_path(filepath, "result/extracted_archives", "Archive file", path_prefix);
-                // Ȼݹѹ
-                recursive_extract(filepath, base_extract_dir, depth, base_extract_dir, path_prefix);
-            } else {
-                // ͨļͷ
-                if (is_c_file(file_info.name)) {
-                    copy_file_with_path(filepath, "result/extracted_c_files", "C file", path_prefix);
-                } else if (is_modified_extension_file(filepath)) {
-                    copy_file_with_path(filepath, "result/extracted_modified_files", "modified extension file", path_prefix);
-                } else {
-                    // ļҲȡ
-                    copy_file_with_path(filepath, "result/extracted_other_files", "other file", path_prefix);
-                }
-            }
+            pos = row_append(row, pos, cap, "null");
         }
-    } while (_findnext(handle, &file_info) == 0);
+        pos = row_append(row, pos, cap, ",\"output\":");
+        if (dest_path) pos = json_string(row, pos, cap, dest_path);
+        else pos = row_append(row, pos, cap, "null");
+        pos = row_append(row, pos, cap, ",\"linked\":%s}", action[0] == 'L' ? "true" : "false");
+        if (pos + 1 < cap) break;       // 还要放换行
+        if (row != stack_row) free(row);
+        cap *= 4;
+        row = malloc(cap);
+        if (!row) break;
+    }
 
-    _findclose(handle);
-#else
-    DIR *dir = opendir(current_dir);
-    if (!dir) {
-        return;
+#ifndef _WIN32
+    pthread_mutex_lock(&g_manifest.lock);
+#endif
+    if (row) {
+        row[pos++] = '\n';
+        fwrite(row, 1, pos, g_manifest.fp);
+        g_manifest.rows++;
+    } else {
+        g_manifest.dropped++;       // 内存不足，在汇总中报告
     }
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_manifest.lock);
+#endif
+    if (row != stack_row) free(row);
+}
 
-    struct dirent *entry;
-    char filepath[1024];
+// 记录一个输出文件：打印日志行（非 --quiet），并写入清单
+void report_output(const char *action, const char *reason, const char *src, const char *dest_dir,
+                   const char *relative_path, const char *filename, const char *dest_path,
+                   uint64_t size, const char *type, const uint8_t *digest) {
+    if (!g_manifest.quiet) log_printf("%s %s: %s -> %s\n", action, reason, src, dest_path);
+    if (size == UINT64_MAX && (g_manifest.fp || stats_enabled())) {
+        struct stat st;
+        size = stat(dest_path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+    stats_output(dest_dir, action[0] == 'L', size);
+    layout_record(dest_path, relative_path, filename);
+    manifest_add(action, dest_dir, relative_path, filename, dest_path, size, type, digest);
+}
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
+/* ---- 输出筛选 ---- */
+// --only 选择写出哪些分类，--include / --exclude 按通配符筛选成员（不含 '/' 的模式只匹配文件名，
+// 否则匹配包内完整路径）。include 只约束普通文件，压缩包总会被展开；被 exclude 的压缩包既不保存也不展开。
+// 没有写出的文件默认直接跳过，数据只读过不落盘；--index-only 时改为在清单中记下名称、大小和哈希
+#define FILTER_MAX_GLOBS 64
 
-        snprintf(filepath, sizeof(filepath), "%s/%s", current_dir, entry->d_name);
+static struct {
+    unsigned     write_mask;                    // 按 output_categories 下标
+    int          index_only;
+    const char  *include[FILTER_MAX_GLOBS];
+    const char  *exclude[FILTER_MAX_GLOBS];
+    int          n_include, n_exclude;
+    unsigned long skipped, indexed;
+} g_filter = { (1u << OUTPUT_CATEGORIES) - 1, 0, { NULL }, { NULL }, 0, 0, 0, 0 };
 
-        // ·
-        char relative_path[1024];
-        if (current_path && strlen(current_path) > 0) {
-            snprintf(relative_path, sizeof(relative_path), "%s/%s", current_path, entry->d_name);
-        } else {
-            strncpy(relative_path, entry->d_name, sizeof(relative_path) - 1);
-            relative_path[sizeof(relative_path) - 1] = '\0';
+// 按逗号分隔的分类名设置要写出的分类，名称可以是清单中的 key 或简称（c / archive / modified / other）
+int filter_set_categories(const char *list) {
+    static const char *const short_names[] = { "c", "archive", "modified", "other" };
+    unsigned mask = 0;
+    const char *p = list;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        int found = 0;
+        for (int c = 0; c < OUTPUT_CATEGORIES; c++) {
+            if ((strlen(output_categories[c].key) == len && strncmp(p, output_categories[c].key, len) == 0) ||
+                (strlen(short_names[c]) == len && strncmp(p, short_names[c], len) == 0)) {
+                mask |= 1u << c;
+                found = 1;
+            }
         }
-
-        // ǰ·ǰ׺ǰļ
-        char path_prefix[1024];
-        if (current_path && strlen(current_path) > 0) {
-            strncpy(path_prefix, current_path, sizeof(path_prefix) - 1);
-            path_prefix[sizeof(path_prefix) - 1] = '\0';
-        } else {
-            path_prefix[0] = '\0';
+        if (!found) {
+            log_printf("Error: Unknown category: %.*s\n", (int)len, p);
+            return 0;
         }
+        p += len;
+        if (*p == ',') p++;
+    }
+    g_filter.write_mask = mask;
+    return 1;
+}
 
-        struct stat file_stat;
-        if (stat(filepath, &file_stat) != 0) {
-            continue;
-        }
+int filter_add_glob(const char *pattern, int exclude) {
+    int *n = exclude ? &g_filter.n_exclude : &g_filter.n_include;
+    if (*n >= FILTER_MAX_GLOBS) return 0;
+    (exclude ? g_filter.exclude : g_filter.include)[(*n)++] = pattern;
+    return 1;
+}
+
+void filter_set_index_only(int on) {
+    g_filter.index_only = on;
+}
 
-        if (S_ISDIR(file_stat.st_mode)) {
-            // ݹ鴦Ŀ¼
-            recursive_process_files(filepath, base_extract_dir, depth, relative_path);
+// 通配符匹配：* 任意串，? 任意单个字符
+static int glob_match(const char *pat, const char *s) {
+    const char *star = NULL, *resume = NULL;
+    while (*s) {
+        if (*pat == '*') {
+            star = pat++;
+            resume = s;
+        } else if (*pat == '?' || *pat == *s) {
+            pat++;
+            s++;
+        } else if (star) {
+            pat = star + 1;
+            s = ++resume;
         } else {
-            // ļ
-            if (is_archive_file(entry->d_name)) {
-                // ȡѹarchivesĿ¼
-                copy_file_with_path(filepath, "result/extracted_archives", "ѹ", path_prefix);
-                // Ȼݹѹ
-                recursive_extract(filepath, base_extract_dir, depth, base_extract_dir, path_prefix);
-            } else {
-                // ͨļͷ
-                if (is_c_file(entry->d_name)) {
-                    copy_file_with_path(filepath, "result/extracted_c_files", "CԴļ", path_prefix);
-                } else if (is_modified_extension_file(filepath)) {
-                    copy_file_with_path(filepath, "result/extracted_modified_files", "޸չļ", path_prefix);
-                } else {
-                    // ļҲȡ
-                    copy_file_with_path(filepath, "result/extracted_other_files", "ļ", path_prefix);
-                }
-            }
+            return 0;
         }
     }
+    while (*pat == '*') pat++;
+    return *pat == '\0';
+}
 
-    closedir(dir);
-#endif
+static int glob_list_match(const char *const *globs, int n, const char *path, const char *filename) {
+    for (int i = 0; i < n; i++) {
+        if (glob_match(globs[i], strchr(globs[i], '/') ? path : filename)) return 1;
+    }
+    return 0;
 }
 
-// ʱĿ¼
-void cleanup_temp_dir(const char *temp_dir) {
-    char command[512];
+static void filter_count(unsigned long *counter) {
 #ifdef _WIN32
-    snprintf(command, sizeof(command), "rmdir /s /q \"%s\" 2>nul", temp_dir);
+    (*counter)++;
 #else
-    snprintf(command, sizeof(command), "rm -rf \"%s\"", temp_dir);
+    __sync_add_and_fetch(counter, 1);
 #endif
-    system(command);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("use: %s <archive file path>\n", argv[0]);
-        return 1;
-    }
-
-    const char *tar_path = argv[1];
+// 只凭路径就能确定跳过的成员（被 --exclude 且不需要记入清单），zip 等可以随机访问的格式连头部也不必读
+int filter_skips_name(const char *path_prefix, const char *filename) {
+    if (!g_filter.n_exclude || g_filter.index_only) return 0;
+    char *path = path_join(path_prefix, filename);
+    int match = glob_list_match(g_filter.exclude, g_filter.n_exclude, path ? path : filename, filename);
+    free(path);
+    if (!match) return 0;
+    filter_count(&g_filter.skipped);
+    return 1;
+}
+
+// 决定一个成员如何处理。普通文件返回 WRITE / INDEX / SKIP；压缩包返回 WRITE（保存副本并展开）、
+// EXPAND（只展开）、INDEX（展开并在清单中记一行）或 SKIP（不展开）（dest_dir 为分类目录，path_prefix 为所在目录的路径前缀）
+int filter_decide(const char *dest_dir, const char *path_prefix, const char *filename) {
+    int cat = output_category(dest_dir);
+    int archive = strcmp(dest_dir, "result/extracted_archives") == 0;
+
+    int wanted = (g_filter.write_mask >> cat) & 1;
+    if (g_filter.n_include || g_filter.n_exclude) {
+        char *path = path_join(path_prefix, filename);
+        const char *full = path ? path : filename;
+        if (glob_list_match(g_filter.exclude, g_filter.n_exclude, full, filename)) {
+            if (archive) {
+                free(path);
+                filter_count(&g_filter.skipped);
+                return FILTER_SKIP;
+            }
+            wanted = 0;
+        } else if (!archive && g_filter.n_include && !glob_list_match(g_filter.include, g_filter.n_include, full, filename)) {
+            wanted = 0;
+        }
+        free(path);
+    }
+    if (wanted) return FILTER_WRITE;
+    if (archive) return g_filter.index_only ? FILTER_INDEX : FILTER_EXPAND;
+
+    filter_count(g_filter.index_only ? &g_filter.indexed : &g_filter.skipped);
+    return g_filter.index_only ? FILTER_INDEX : FILTER_SKIP;
+}
+
+// 去重和缓存回放的是另一个路径下的结果：只有筛选结果与路径无关、也不需要补记清单时才能直接回放
+int filter_replayable(void) {
+    if (g_filter.index_only) return 0;
+    for (int i = 0; i < g_filter.n_include; i++) if (strchr(g_filter.include[i], '/')) return 0;
+    for (int i = 0; i < g_filter.n_exclude; i++) if (strchr(g_filter.exclude[i], '/')) return 0;
+    return 1;
+}
+
+// 筛选条件参与缓存 key，条件不同的运行不共用结果（默认条件不参与，已有的缓存仍然有效）
+void filter_fingerprint(Sha256 *ctx) {
+    if (g_filter.write_mask == (1u << OUTPUT_CATEGORIES) - 1 && !g_filter.n_include && !g_filter.n_exclude) return;
+    uint8_t mask = (uint8_t)g_filter.write_mask;
+    sha256_update(ctx, &mask, 1);
+    for (int i = 0; i < g_filter.n_include; i++) sha256_update(ctx, g_filter.include[i], strlen(g_filter.include[i]) + 1);
+    sha256_update(ctx, "", 1);
+    for (int i = 0; i < g_filter.n_exclude; i++) sha256_update(ctx, g_filter.exclude[i], strlen(g_filter.exclude[i]) + 1);
+}
+
+// 输出筛掉的文件数
+void print_filter_stats(void) {
+    if (g_filter.skipped || g_filter.indexed)
+        log_printf("- Filters: %lu files skipped, %lu indexed only\n", g_filter.skipped, g_filter.indexed);
+}
+
+// 创建输出目录
+// 输出根目录：分类目录在代码中一律写作 result/extracted_*，写文件时换到这里（库调用方可以指定）
+static char g_out_root[1024] = "result";
+
+// 设置输出根目录；过长时不截断，保持原值并返回 0
+int output_set_root(const char *dir) {
+    if (strlen(dir) >= sizeof(g_out_root)) return 0;
+    snprintf(g_out_root, sizeof(g_out_root), "%s", dir);
+    return 1;
+}
+
+// 分类目录的实际路径
+static void output_dir_path(char *path, size_t size, const char *dest_dir) {
+    if (strncmp(dest_dir, "result/", 7) == 0) snprintf(path, size, "%s/%s", g_out_root, dest_dir + 7);
+    else snprintf(path, size, "%s", dest_dir);
+}
+
+void create_output_dirs() {
+    char dir[1100];
+    my_mkdir(g_out_root);
+    for (int i = 0; i < OUTPUT_CATEGORIES; i++) {
+        output_dir_path(dir, sizeof(dir), output_categories[i].dest_dir);
+        my_mkdir(dir);
+    }
+}
+
+// 获取文件名（跨平台）
+const char* get_filename(const char* path) {
+    const char* filename = strrchr(path, '/');
+    if (!filename) filename = strrchr(path, '\\');
+    return filename ? filename + 1 : path;
+}
+
+// 安全的文件名处理（替换路径分隔符为特殊分隔符）
+void safe_filename(char *filename) {
+    for (int i = 0; filename[i]; i++) {
+        if (filename[i] == '/' || filename[i] == '\\') {
+            filename[i] = '@';  // 使用@作为路径分隔符替代
+        } else if (filename[i] == ':' || filename[i] == '*' ||
+                   filename[i] == '?' || filename[i] == '"' ||
+                   filename[i] == '<' || filename[i] == '>' || filename[i] == '|') {
+            filename[i] = '#';  // 其他特殊字符用#替代
+        }
+    }
+}
+
+char *dup_str(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = malloc(len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+// 拼接路径链：prefix 为空时就是 name。路径链没有长度上限，结果在堆上分配，调用方释放
+char *path_join(const char *prefix, const char *name) {
+    if (!prefix || !prefix[0]) return dup_str(name);
+    size_t a = strlen(prefix), b = strlen(name) + 1;
+    char *path = malloc(a + 1 + b);
+    if (!path) return NULL;
+    memcpy(path, prefix, a);
+    path[a] = '/';
+    memcpy(path + a + 1, name, b);
+    return path;
+}
+
+/* ---- 分片输出布局 ---- */
+// --layout sharded：按（路径链 + 文件名）的哈希分到 dest_dir/xx/yy/ 两级子目录，每个目录中的文件数保持在
+// 几十个以内，大量输出时创建文件不再随目录变大而变慢。文件名不再带路径前缀，同一次运行中重名的输出改为
+// name~N.ext，不互相覆盖；输出路径与原始路径链的对应关系写入 result/paths.jsonl
+#define LAYOUT_SHARDS 65536
+
+static struct {
+    int       sharded;
+    uint8_t   made[OUTPUT_CATEGORIES][LAYOUT_SHARDS / 8];   // 已创建的分片目录（按分类）
+    uint64_t *claims;                       // 本次运行已占用的输出路径（路径哈希，开放寻址）
+    size_t    n_claims, cap;
+    unsigned long renamed;
+    unsigned long dropped;                  // 内存不足没能写进 paths.jsonl 的行
+    FILE     *map;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} g_layout = {
+    0, { { 0 } }, NULL, 0, 0, 0, 0, NULL,
+#ifndef _WIN32
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+int layout_set(const char *name) {
+    if (strcmp(name, "flat") == 0) g_layout.sharded = 0;
+    else if (strcmp(name, "sharded") == 0) g_layout.sharded = 1;
+    else return 0;
+    return 1;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// 占用一个输出路径，已被本次运行占用时返回 0（调用者持有锁）
+static int layout_claim(const char *path) {
+    uint64_t h = fnv1a(0xcbf29ce484222325ull, path, strlen(path));
+    if (h == 0) h = 1;
+    if ((g_layout.n_claims + 1) * 2 > g_layout.cap) {
+        size_t new_cap = g_layout.cap ? g_layout.cap * 2 : 4096;
+        uint64_t *slots = calloc(new_cap, sizeof(uint64_t));
+        if (!slots) return 1;   // 内存不足时不再检查重名
+        for (size_t i = 0; i < g_layout.cap; i++) {
+            if (!g_layout.claims[i]) continue;
+            size_t j;
+            for (j = g_layout.claims[i] % new_cap; slots[j]; j = (j + 1) % new_cap) {
+            }
+            slots[j] = g_layout.claims[i];
+        }
+        free(g_layout.claims);
+        g_layout.claims = slots;
+        g_layout.cap = new_cap;
+    }
+    size_t i;
+    for (i = h % g_layout.cap; g_layout.claims[i]; i = (i + 1) % g_layout.cap) {
+        if (g_layout.claims[i] == h) return 0;
+    }
+    g_layout.claims[i] = h;
+    g_layout.n_claims++;
+    return 1;
+}
+
+// 分片布局下的目标路径：dest_dir/xx/yy/filename，重名时在扩展名前加 ~N。放不下时返回 0
+static int layout_dest_path(char *dest_path, size_t size, const char *dest_dir, const char *filename, const char *relative_path) {
+    const char *chain = relative_path ? relative_path : "";
+    uint64_t h = fnv1a(0xcbf29ce484222325ull, chain, strlen(chain) + 1);
+    h = fnv1a(h, filename, strlen(filename));
+    unsigned shard = (unsigned)(h >> 48);
+
+    // 分片目录按需创建，位图只用来省掉重复的 mkdir，并发时重复创建也无妨
+    int cat = output_category(dest_dir);
+    uint8_t bit = (uint8_t)(1u << (shard & 7));
+    char root[1100], dir[1200];
+    output_dir_path(root, sizeof(root), dest_dir);
+    snprintf(dir, sizeof(dir), "%s/%02x/%02x", root, shard >> 8, shard & 0xff);
+#ifdef _WIN32
+    int made = g_layout.made[cat][shard >> 3] & bit;
+#else
+    int made = __atomic_load_n(&g_layout.made[cat][shard >> 3], __ATOMIC_ACQUIRE) & bit;
+#endif
+    if (!made) {
+        dir[strlen(root) + 3] = '\0';
+        my_mkdir(dir);
+        dir[strlen(root) + 3] = '/';
+        my_mkdir(dir);
+#ifdef _WIN32
+        g_layout.made[cat][shard >> 3] |= bit;
+#else
+        __atomic_fetch_or(&g_layout.made[cat][shard >> 3], bit, __ATOMIC_RELEASE);
+#endif
+    }
+
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) dot = filename + strlen(filename);
+#ifndef _WIN32
+    pthread_mutex_lock(&g_layout.lock);
+#endif
+    int len = snprintf(dest_path, size, "%s/%s", dir, filename);
+    for (unsigned long n = 1; len > 0 && (size_t)len < size && !layout_claim(dest_path); n++) {
+        len = snprintf(dest_path, size, "%s/%.*s~%lu%s", dir, (int)(dot - filename), filename, n, dot);
+        if (n == 1) g_layout.renamed++;
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_layout.lock);
+#endif
+    return len > 0 && (size_t)len < size;
+}
+
+// 输出成功后记录它对应的原始路径链
+void layout_record(const char *dest_path, const char *relative_path, const char *filename) {
+    if (!g_layout.map) return;
+    // 同 manifest_add：路径链很长时换成更大的堆缓冲区重新拼
+    char stack_row[4096];
+    char *row = stack_row;
+    size_t cap = sizeof(stack_row);
+    size_t pos;
+    for (;;) {
+        pos = row_append(row, 0, cap, "{\"output\":");
+        pos = json_string(row, pos, cap, dest_path);
+        pos = row_append(row, pos, cap, ",\"chain\":");
+        pos = json_string(row, pos, cap, relative_path ? relative_path : "");
+        pos = row_append(row, pos, cap, ",\"name\":");
+        pos = json_string(row, pos, cap, filename);
+        pos = row_append(row, pos, cap, "}\n");
+        if (pos < cap) break;
+        if (row != stack_row) free(row);
+        cap *= 4;
+        row = malloc(cap);
+        if (!row) break;
+    }
+#ifndef _WIN32
+    pthread_mutex_lock(&g_layout.lock);
+#endif
+    if (row) fwrite(row, 1, pos, g_layout.map);
+    else g_layout.dropped++;
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_layout.lock);
+#endif
+    if (row != stack_row) free(row);
+}
+
+// 打开路径对应表（create_output_dirs 之后调用）
+int layout_open(void) {
+    if (!g_layout.sharded) return 1;
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/paths.jsonl", g_out_root);
+    g_layout.map = fopen(path, "wb");
+    if (!g_layout.map) {
+        log_printf("Error: Unable to open the source file, %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+void layout_close(void) {
+    // 占用表在平铺布局下也会用到（批处理的作业名）
+    free(g_layout.claims);
+    g_layout.claims = NULL;
+    g_layout.n_claims = g_layout.cap = 0;
+    if (!g_layout.sharded) return;
+    if (g_layout.map && fclose(g_layout.map) != 0) log_printf("Waring: Unable to write the file, %s/paths.jsonl\n", g_out_root);
+    g_layout.map = NULL;
+    log_printf("- Layout: sharded, %lu duplicate names renamed, paths recorded in %s/paths.jsonl\n", g_layout.renamed, g_out_root);
+    if (g_layout.dropped) log_printf("Waring: %lu paths.jsonl entries were dropped (out of memory)\n", g_layout.dropped);
+}
+
+// 生成目标文件路径（带路径前缀）。路径链不截断：放不下时报错并返回 0，调用方跳过这个文件
+int make_dest_path(char *dest_path, size_t size, const char *dest_dir, const char *filename, const char *relative_path) {
+    char root[1100];
+    int len = 1;
+
+    if (g_layout.sharded) {
+        if (!layout_dest_path(dest_path, size, dest_dir, filename, relative_path)) len = -1;
+    } else {
+        output_dir_path(root, sizeof(root), dest_dir);
+        dest_dir = root;
+
+        // 创建安全的路径前缀
+        if (relative_path && strlen(relative_path) > 0) {
+            char *safe_path = dup_str(relative_path);
+            if (!safe_path) return 0;
+            safe_filename(safe_path);
+            len = snprintf(dest_path, size, "%s/[%s]%s", dest_dir, safe_path, filename);
+            free(safe_path);
+        } else {
+            len = snprintf(dest_path, size, "%s/%s", dest_dir, filename);
+        }
+    }
+    if (len > 0 && (size_t)len < size) return 1;
+    log_printf("Error: The output path is too long, %s\n", filename);
+    return 0;
+}
+
+/* 复制后端：依次尝试 reflink、copy_file_range、sendfile，最后退回大块对齐缓冲区 */
+typedef enum {
+    COPY_REFLINK,           // FICLONE，btrfs / XFS 上共享数据块，不复制数据
+    COPY_RANGE,             // copy_file_range，数据留在内核里
+    COPY_SENDFILE,          // sendfile，数据留在内核里
+    COPY_BUFFER,            // 用户态缓冲区
+    COPY_METHODS
+} CopyMethod;
+
+static const char *copy_method_names[COPY_METHODS] = { "reflink", "copy_file_range", "sendfile", "buffer" };
+static unsigned long copy_method_count[COPY_METHODS];
+
+#define COPY_BUF_SIZE (1 << 20)
+
+#ifndef _WIN32
+// 从 offset 开始用对齐缓冲区复制剩余数据，返回 0 表示成功
+static int copy_fd_buffered(int in_fd, int out_fd, off_t offset) {
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, 4096, COPY_BUF_SIZE) != 0) return -1;
+
+    int rc = 0;
+    for (;;) {
+        ssize_t got = pread(in_fd, buffer, COPY_BUF_SIZE, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            rc = (got < 0) ? -1 : 0;
+            break;
+        }
+        ssize_t done = 0;
+        while (done < got) {
+            ssize_t put = pwrite(out_fd, (char *)buffer + done, (size_t)(got - done), offset + done);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) {
+                rc = -1;
+                break;
+            }
+            done += put;
+        }
+        if (rc != 0) break;
+        offset += got;
+    }
+    free(buffer);
+    return rc;
+}
+
+// 复制整个文件，返回实际使用的复制方式，失败返回 -1
+static int copy_fd(int in_fd, int out_fd, off_t size) {
+    off_t copied = 0;
+
+#ifdef __linux__
+    // 1) reflink：同一文件系统且支持时瞬间完成
+    if (ioctl(out_fd, FICLONE, in_fd) == 0) return COPY_REFLINK;
+
+    // 2) copy_file_range：跨文件系统或不支持 reflink 时仍可在内核中复制
+    int method = -1;
+    while (copied < size) {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, (size_t)(size - copied), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += n;
+        method = COPY_RANGE;
+    }
+    if (copied >= size) return method < 0 ? COPY_RANGE : method;
+
+    // 3) sendfile：从已复制的位置继续
+    off_t offset = copied;
+    while (copied < size) {
+        ssize_t n = sendfile(out_fd, in_fd, &offset, (size_t)(size - copied));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += n;
+        method = COPY_SENDFILE;
+    }
+    if (copied >= size) return method;
+#else
+    (void)size;
+#endif
+
+    // 4) 用户态缓冲区，同时兼容 stat 大小不准确的文件
+    if (copy_fd_buffered(in_fd, out_fd, copied) != 0) return -1;
+    return COPY_BUFFER;
+}
+#endif
+
+// 把 src 复制为 dest_path，返回使用的复制方式，失败返回 -1
+static int out_fsync = 0;           // --fsync：每个输出文件落盘后再关闭
+
+void out_set_fsync(int on) {
+    out_fsync = on;
+}
+
+// 打开输出文件写入。已有的同名文件先删掉：它可能是去重建的硬链接，原地截断会连同所有别名一起改写
+FILE *out_fopen(const char *path) {
+#ifndef _WIN32
+    unlink(path);
+#endif
+    return fopen(path, "wb");
+}
+
+int copy_path(const char *src, const char *dest_path) {
+#ifdef _WIN32
+    FILE *src_file = fopen(src, "rb");
+    if (!src_file) {
+        log_printf("Error: Unable to open the source file, %s\n", src);
+        return -1;
+    }
+
+    FILE *dest_file = out_fopen(dest_path);
+    if (!dest_file) {
+        log_printf("Error: Unable to open the source file, %s\n", dest_path);
+        fclose(src_file);
+        return -1;
+    }
+
+    int method = -1;
+    char *buffer = malloc(COPY_BUF_SIZE);
+    if (buffer) {
+        size_t bytes;
+        while ((bytes = fread(buffer, 1, COPY_BUF_SIZE, src_file)) > 0) {
+            fwrite(buffer, 1, bytes, dest_file);
+        }
+        free(buffer);
+        method = COPY_BUFFER;
+    }
+
+    fclose(src_file);
+    fclose(dest_file);
+    if (method >= 0) copy_method_count[method]++;
+    return method;
+#else
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        log_printf("Error: Unable to open the source file, %s\n", src);
+        return -1;
+    }
+    int method = copy_fd_path(src_fd, src, dest_path);
+    close(src_fd);
+    return method;
+#endif
+}
+
+#ifndef _WIN32
+// 从已打开的 src_fd 复制到 dest_path（从文件开头复制，与 src_fd 当前位置无关）
+int copy_fd_path(int src_fd, const char *src, const char *dest_path) {
+    struct stat st;
+    if (fstat(src_fd, &st) != 0) {
+        log_printf("Error: Unable to open the source file, %s\n", src);
+        return -1;
+    }
+
+    unlink(dest_path);      // 不截断已有文件，见 out_fopen
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dest_fd < 0) {
+        log_printf("Error: Unable to open the source file, %s\n", dest_path);
+        return -1;
+    }
+
+    lseek(src_fd, 0, SEEK_SET);
+    int method = copy_fd(src_fd, dest_fd, st.st_size);
+    if (out_fsync) fsync(dest_fd);
+    close(dest_fd);
+
+    if (method >= 0) __sync_fetch_and_add(&copy_method_count[method], 1);
+    return method;
+}
+#endif
+
+// 复制文件到指定目录（带路径前缀）；开启去重时 digest 返回内容哈希
+int copy_file_with_digest(const char *src, const char *dest_dir, const char *reason, const char *relative_path, uint8_t digest[32]) {
+#ifdef _WIN32
+    char dest_path[2048];
+    const char *filename = get_filename(src);
+    if (!make_dest_path(dest_path, sizeof(dest_path), dest_dir, filename, relative_path)) return 0;
+
+    // 去重：先算内容哈希，已有相同内容的输出时直接建硬链接
+    uint64_t t0 = stats_now();
+    int hashed = (dedup_enabled() || manifest_enabled()) && sha256_file(src, digest);
+    if (hashed && dedup_enabled()) {
+        if (dedup_output(digest, dest_path)) {
+            report_output("Linked", reason, src, dest_dir, relative_path, filename, dest_path, UINT64_MAX, NULL, digest);
+            dedup_record_output(dest_dir, reason, relative_path, filename, dest_path, digest);
+            return 1;
+        }
+    }
+
+    if (copy_path(src, dest_path) < 0) {
+        log_printf("Error: Unable to copy the file, %s\n", src);
+        return 0;
+    }
+
+    stats_time(ST_COPY, t0);
+    report_output("Extracted", reason, src, dest_dir, relative_path, filename, dest_path, UINT64_MAX, NULL,
+                  hashed ? digest : NULL);
+    if (dedup_enabled()) dedup_record_output(dest_dir, reason, relative_path, filename, dest_path, digest);
+    return 1;
+#else
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        log_printf("Error: Unable to open the source file, %s\n", src);
+        log_printf("Error: Unable to copy the file, %s\n", src);
+        return 0;
+    }
+    int ok = copy_open_file(src_fd, src, dest_dir, reason, relative_path, digest);
+    close(src_fd);
+    return ok;
+#endif
+}
+
+#ifndef _WIN32
+// 同 copy_file_with_digest，但源文件已经打开（分类时读过头部，不必再打开一次）
+int copy_open_file(int src_fd, const char *src, const char *dest_dir, const char *reason, const char *relative_path, uint8_t digest[32]) {
+    char dest_path[2048];
+    const char *filename = get_filename(src);
+    if (!make_dest_path(dest_path, sizeof(dest_path), dest_dir, filename, relative_path)) return 0;
+
+    // 写清单时记下大小和类型
+    uint64_t t0 = stats_now();
+    uint64_t size = UINT64_MAX;
+    const char *type = NULL;
+    if (manifest_enabled()) {
+        struct stat st;
+        uint8_t head[MAGIC_HEAD_SIZE];
+        ssize_t n = pread(src_fd, head, sizeof(head), 0);
+        type = magic_type_name(head, n > 0 ? (size_t)n : 0);
+        if (fstat(src_fd, &st) == 0) size = (uint64_t)st.st_size;
+    }
+
+    // 去重：先算内容哈希，已有相同内容的输出时直接建硬链接
+    int hashed = (dedup_enabled() || manifest_enabled()) && sha256_fd(src_fd, digest);
+    if (hashed && dedup_enabled()) {
+        if (dedup_output(digest, dest_path)) {
+            report_output("Linked", reason, src, dest_dir, relative_path, filename, dest_path, size, type, digest);
+            dedup_record_output(dest_dir, reason, relative_path, filename, dest_path, digest);
+            return 1;
+        }
+    }
+
+    if (copy_fd_path(src_fd, src, dest_path) < 0) {
+        log_printf("Error: Unable to copy the file, %s\n", src);
+        return 0;
+    }
+
+    stats_time(ST_COPY, t0);
+    report_output("Extracted", reason, src, dest_dir, relative_path, filename, dest_path, size, type,
+                  hashed ? digest : NULL);
+    if (dedup_enabled()) dedup_record_output(dest_dir, reason, relative_path, filename, dest_path, digest);
+    return 1;
+}
+#endif
+
+// 复制文件到指定目录（带路径前缀）
+int copy_file_with_path(const char *src, const char *dest_dir, const char *reason, const char *relative_path) {
+    uint8_t digest[32];
+    return copy_file_with_digest(src, dest_dir, reason, relative_path, digest);
+}
+
+// 输出各复制方式的使用次数
+void print_copy_stats(void) {
+    unsigned long total = 0;
+    for (int i = 0; i < COPY_METHODS; i++) total += copy_method_count[i];
+    if (total == 0) return;
+
+    printf("- Copy backend:");
+    for (int i = 0; i < COPY_METHODS; i++) {
+        if (copy_method_count[i]) printf(" %s %lu", copy_method_names[i], copy_method_count[i]);
+    }
+    printf("\n");
+}
+
+// 复制文件到指定目录
+int copy_file(const char *src, const char *dest_dir, const char *reason) {
+    return copy_file_with_path(src, dest_dir, reason, NULL);
+}
+
+/* ---- 小文件批量写出（io_uring） ---- */
+// 成员数据一次读完且不超过 OUT_SMALL_MAX 的文件，把 openat / write /（fsync）/ close 串成一条链提交给
+// io_uring，每个线程一个环，同时最多 OUT_RING_SLOTS 个文件在途，攒够一批才进一次内核。
+// 内核不支持（或被禁用）时 out_ring_get() 返回 NULL，调用者照常同步写出
+#define OUT_SMALL_MAX   (64 * 1024)
+#define OUT_RING_SLOTS  32
+#define OUT_RING_ENTRIES 256        // 最长的链 5 个 SQE（带 --fsync），OUT_RING_SLOTS * 5 向上取到 2 的幂
+
+#ifdef HAVE_IO_URING
+typedef struct {
+    int                  fd;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr, *cq_ptr;
+    size_t               sq_len, cq_len, sqes_len;
+    unsigned             sq_entries;
+    unsigned             to_submit;     // 已填写、尚未提交的 SQE
+} Uring;
+
+// 整条链成功后才登记的输出信息（日志行、清单、paths.jsonl），写失败的文件不留下记录
+typedef struct {
+    const char    *reason;          // 以下三个为字符串常量
+    const char    *dest_dir;
+    const char    *type;
+    const char    *src;
+    const char    *relative_path;
+    const uint8_t *digest;          // NULL 表示没有计算哈希
+} OutReport;
+
+typedef struct {
+    char    *path;          // NULL 表示空闲
+    uint8_t *buf;
+    size_t   len;
+    int      pending;       // 尚未完成的 CQE
+    int      error;         // 第一个失败操作的 errno
+    OutReport report;       // src、relative_path 为副本，digest 指向 hash
+    uint8_t  hash[32];
+} OutSlot;
+
+typedef struct {
+    Uring   ring;
+    OutSlot slot[OUT_RING_SLOTS];
+    int     busy;
+} OutRing;
+
+static __thread OutRing *tls_out_ring = NULL;
+static __thread int tls_out_ring_failed = 0;
+static int out_ring_disabled = 0;
+static unsigned long out_ring_files = 0;
+
+static int uring_setup(Uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) goto fail;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail:
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_len);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    close(r->fd);
+    return -1;
+}
+
+static void uring_close(Uring *r) {
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+// 取一个空的 SQE（调用者保证环里有空位）
+static struct io_uring_sqe *uring_sqe(Uring *r, uint8_t opcode, uint64_t user_data) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+// SQ 里还能填几个 SQE（内核取走之前的都算占用）
+static unsigned uring_sq_space(Uring *r) {
+    return r->sq_entries - (*r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+// 提交已填写的 SQE，并至少等到 wait 个完成事件
+static int uring_enter(Uring *r, unsigned wait) {
+    for (;;) {
+        int rc = (int)syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) {
+            r->to_submit -= (unsigned)rc < r->to_submit ? (unsigned)rc : r->to_submit;
+            return 0;
+        }
+        if (errno != EINTR) return -1;
+    }
+}
+
+// 处理已完成的事件，文件的整条链结束后释放槽位
+static void out_ring_reap(OutRing *o) {
+    Uring *r = &o->ring;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        OutSlot *s = &o->slot[cqe->user_data >> 8];
+        int op = (int)(cqe->user_data & 0xFF);
+        if (!s->error && op != IORING_OP_UNLINKAT) {
+            if (cqe->res < 0 && cqe->res != -ECANCELED) s->error = -cqe->res;
+            else if (op == IORING_OP_WRITE && cqe->res >= 0 && (size_t)cqe->res != s->len) s->error = EIO;
+        }
+        if (--s->pending == 0) {
+            OutReport *r = &s->report;
+            if (s->error) {
+                log_printf("Error: Unable to write the file, %s (%s)\n", s->path, strerror(s->error));
+                remove(s->path);
+            } else {
+                report_output("Extracted", r->reason, r->src, r->dest_dir, r->relative_path, get_filename(r->src),
+                              s->path, s->len, r->type, r->digest);
+                __sync_fetch_and_add(&out_ring_files, 1);
+            }
+            free((char *)r->src);
+            free((char *)r->relative_path);
+            free(s->path);
+            free(s->buf);
+            s->path = NULL;
+            o->busy--;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// 当前线程的写出环；不可用时返回 NULL
+static OutRing *out_ring_get(void) {
+    if (tls_out_ring) return tls_out_ring;
+    if (out_ring_disabled || tls_out_ring_failed) return NULL;
+
+    OutRing *o = calloc(1, sizeof(OutRing));
+    if (!o || uring_setup(&o->ring, OUT_RING_ENTRIES) != 0) goto fail;
+
+    // 每个槽位对应一个直接描述符，openat 打开到槽位里，后续操作按槽位引用，整条链无需回到用户态
+    int fds[OUT_RING_SLOTS];
+    for (int i = 0; i < OUT_RING_SLOTS; i++) fds[i] = -1;
+    if (syscall(__NR_io_uring_register, o->ring.fd, IORING_REGISTER_FILES, fds, OUT_RING_SLOTS) < 0) {
+        uring_close(&o->ring);
+        goto fail;
+    }
+
+    // 试一次：内核太旧（不支持直接描述符的 openat/close）时放弃
+    struct io_uring_sqe *sqe = uring_sqe(&o->ring, IORING_OP_OPENAT, 0);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)".";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = uring_sqe(&o->ring, IORING_OP_CLOSE, 1);
+    sqe->file_index = 1;
+    int ok = uring_enter(&o->ring, 2) == 0;
+    for (unsigned head = *o->ring.cq_head; head != __atomic_load_n(o->ring.cq_tail, __ATOMIC_ACQUIRE); head++) {
+        if (o->ring.cqes[head & *o->ring.cq_mask].res < 0) ok = 0;
+    }
+    __atomic_store_n(o->ring.cq_head, __atomic_load_n(o->ring.cq_tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    if (!ok) {
+        uring_close(&o->ring);
+        goto fail;
+    }
+
+    tls_out_ring = o;
+    return o;
+
+fail:
+    free(o);
+    tls_out_ring_failed = 1;
+    return NULL;
+}
+
+// 等待当前线程所有在途文件写完
+static void out_ring_drain(OutRing *o) {
+    while (o->busy > 0) {
+        if (uring_enter(&o->ring, 1) != 0) break;
+        out_ring_reap(o);
+    }
+}
+
+// 提交一个文件（成功时接管 buf 并返回 1），写完后按 report 登记输出。
+// 与在途文件同名时先等它写完，保证后写的覆盖先写的
+static int out_ring_write(OutRing *o, const char *path, uint8_t *buf, size_t len, const OutReport *report) {
+    int i;
+    for (i = 0; i < OUT_RING_SLOTS; i++) {
+        if (o->slot[i].path && strcmp(o->slot[i].path, path) == 0) {
+            out_ring_drain(o);
+            break;
+        }
+    }
+    while (o->busy == OUT_RING_SLOTS) {
+        if (uring_enter(&o->ring, 1) != 0) break;
+        out_ring_reap(o);
+    }
+    if (o->busy == OUT_RING_SLOTS) return 0;
+
+    // SQ 放不下整条链时先把攒着的提交掉；进内核失败或仍放不下就让调用者同步写出，不覆盖未提交的 SQE
+    int chain = out_fsync ? 5 : 4;
+    if (uring_sq_space(&o->ring) < (unsigned)chain) {
+        if (uring_enter(&o->ring, 0) != 0) return 0;
+        out_ring_reap(o);
+        if (uring_sq_space(&o->ring) < (unsigned)chain) return 0;
+    }
+    for (i = 0; o->slot[i].path; i++) {
+    }
+
+    OutSlot *s = &o->slot[i];
+    s->path = dup_str(path);
+    s->report = *report;
+    s->report.src = dup_str(report->src);
+    s->report.relative_path = dup_str(report->relative_path ? report->relative_path : "");
+    if (!s->path || !s->report.src || !s->report.relative_path) {
+        free(s->path);
+        free((char *)s->report.src);
+        free((char *)s->report.relative_path);
+        s->path = NULL;
+        return 0;
+    }
+    if (report->digest) {
+        memcpy(s->hash, report->digest, 32);
+        s->report.digest = s->hash;
+    }
+    s->buf = buf;
+    s->len = len;
+    s->error = 0;
+    s->pending = chain;
+    o->busy++;
+
+    // 先删掉已有的同名文件（见 out_fopen）；文件不存在时删除失败，用 HARDLINK 让链继续
+    uint64_t ud = (uint64_t)i << 8;
+    struct io_uring_sqe *sqe = uring_sqe(&o->ring, IORING_OP_UNLINKAT, ud | IORING_OP_UNLINKAT);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)s->path;
+    sqe->flags = IOSQE_IO_HARDLINK;
+
+    sqe = uring_sqe(&o->ring, IORING_OP_OPENAT, ud | IORING_OP_OPENAT);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)s->path;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->len = 0644;
+    sqe->file_index = (uint32_t)i + 1;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = uring_sqe(&o->ring, IORING_OP_WRITE, ud | IORING_OP_WRITE);
+    sqe->fd = i;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+    if (out_fsync) {
+        sqe = uring_sqe(&o->ring, IORING_OP_FSYNC, ud | IORING_OP_FSYNC);
+        sqe->fd = i;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    }
+
+    sqe = uring_sqe(&o->ring, IORING_OP_CLOSE, ud | IORING_OP_CLOSE);
+    sqe->file_index = (uint32_t)i + 1;
+
+    // 攒够一批再进内核，一次系统调用提交多个文件；失败时 SQE 留在环里，下次进内核再提交
+    if (o->ring.to_submit >= OUT_RING_SLOTS * 2 && uring_enter(&o->ring, 0) == 0) {
+        out_ring_reap(o);
+    }
+    return 1;
+}
+#endif
+
+// 写完当前线程在途的文件并释放写出环（线程退出前、进程结束前调用）
+void out_ring_close(void) {
+#ifdef HAVE_IO_URING
+    OutRing *o = tls_out_ring;
+    if (!o) return;
+    out_ring_drain(o);
+    uring_close(&o->ring);
+    free(o);
+    tls_out_ring = NULL;
+#endif
+}
+
+// 把当前线程攒着的文件提交给内核，不等完成（线程空闲或输入暂时没有数据时调用，已解出的成员不必等到凑满一批）
+void out_ring_submit(void) {
+#ifdef HAVE_IO_URING
+    OutRing *o = tls_out_ring;
+    if (!o || o->ring.to_submit == 0) return;
+    uring_enter(&o->ring, 0);
+    out_ring_reap(o);
+#endif
+}
+
+// 禁用 io_uring 写出（--no-uring）
+void out_ring_disable(void) {
+#ifdef HAVE_IO_URING
+    out_ring_disabled = 1;
+#endif
+}
+
+void print_output_stats(void) {
+#ifdef HAVE_IO_URING
+    if (out_ring_files) log_printf("- Output writer: %lu small files written through io_uring\n", out_ring_files);
+#endif
+}
+
+/*========== 3. 输入流与解压器 ==========*/
+// 所有解压器都实现同一个流式读取接口，可以层层叠加（例如 tar 成员 -> xz -> tar 成员 -> gzip -> tar）
+#define STREAM_BUF_SIZE 65536
+
+struct InStream {
+    size_t (*read)(InStream *s, void *buf, size_t n);   // 返回 0 表示结束（出错时同时置 error）
+    void   (*close)(InStream *s);                        // 只释放自身，不关闭下层流
+    int      error;
+};
+
+// 读满 n 字节，除非遇到流结束
+size_t stream_read_full(InStream *s, void *buf, size_t n) {
+    size_t total = 0;
+    while (total < n) {
+        size_t got = s->read(s, (char *)buf + total, n - total);
+        if (got == 0) break;
+        total += got;
+    }
+    return total;
+}
+
+// 读完并丢弃剩余数据
+void stream_drain(InStream *s) {
+    char buf[STREAM_BUF_SIZE];
+    while (s->read(s, buf, sizeof(buf)) > 0) {
+    }
+}
+
+void stream_close(InStream *s) {
+    if (s) s->close(s);
+}
+
+/* ---- 文件 ---- */
+typedef struct {
+    InStream base;
+    FILE    *fp;
+} FileStream;
+
+static size_t file_stream_read(InStream *s, void *buf, size_t n) {
+    FileStream *f = (FileStream *)s;
+    size_t got = fread(buf, 1, n, f->fp);
+    if (got == 0 && ferror(f->fp)) s->error = 1;
+    stats_bytes_in(got);
+    return got;
+}
+
+static void file_stream_close(InStream *s) {
+    FileStream *f = (FileStream *)s;
+    fclose(f->fp);
+    free(f);
+}
+
+InStream *file_stream_open(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    FileStream *f = calloc(1, sizeof(FileStream));
+    if (!f) {
+        fclose(fp);
+        return NULL;
+    }
+    f->base.read = file_stream_read;
+    f->base.close = file_stream_close;
+    f->fp = fp;
+    return &f->base;
+}
+
+#ifndef _WIN32
+// 管道和标准输入：有多少读多少，数据陆续到达时下游不必等满一个缓冲区
+static size_t pipe_stream_read(InStream *s, void *buf, size_t n) {
+    FileStream *f = (FileStream *)s;
+    struct pollfd pfd = { fileno(f->fp), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) == 0) out_ring_submit();     // 要等数据到达：先把已解出的小文件写出去
+    for (;;) {
+        ssize_t got = read(fileno(f->fp), buf, n);
+        if (got >= 0) {
+            stats_bytes_in(got);
+            return (size_t)got;
+        }
+        if (errno != EINTR) {
+            s->error = 1;
+            return 0;
+        }
+    }
+}
+#endif
+
+// 顶层输入："-" 为标准输入（复制一份描述符，关闭时不影响进程的 stdin），其余为文件或命名管道
+InStream *input_stream_open(const char *path) {
+    if (strcmp(path, "-") != 0) {
+        InStream *s = file_stream_open(path);
+#ifndef _WIN32
+        struct stat st;
+        if (s && fstat(fileno(((FileStream *)s)->fp), &st) == 0 && !S_ISREG(st.st_mode)) s->read = pipe_stream_read;
+#endif
+        return s;
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    int fd = _dup(_fileno(stdin));
+    FILE *fp = fd >= 0 ? _fdopen(fd, "rb") : NULL;
+    if (!fp && fd >= 0) _close(fd);
+#else
+    int fd = dup(STDIN_FILENO);
+    FILE *fp = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (!fp && fd >= 0) close(fd);
+#endif
+    if (!fp) return NULL;
+    FileStream *f = calloc(1, sizeof(FileStream));
+    if (!f) {
+        fclose(fp);
+        return NULL;
+    }
+#ifdef _WIN32
+    f->base.read = file_stream_read;
+#else
+    f->base.read = pipe_stream_read;
+#endif
+    f->base.close = file_stream_close;
+    f->fp = fp;
+    return &f->base;
+}
+
+/* ---- 旁路写出：读取的同时把原始数据写入副本 ---- */
+// copy 为 NULL 时不写副本；hash 不为 NULL 时顺便计算内容哈希
+typedef struct {
+    InStream  base;
+    InStream *inner;
+    FILE     *copy;
+    Sha256   *hash;
+    uint64_t  bytes;
+} TeeStream;
+
+static size_t tee_stream_read(InStream *s, void *buf, size_t n) {
+    TeeStream *t = (TeeStream *)s;
+    size_t got = t->inner->read(t->inner, buf, n);
+    t->bytes += got;
+    if (got > 0 && t->hash) sha256_update(t->hash, buf, got);
+    if (got > 0 && t->copy && fwrite(buf, 1, got, t->copy) != got) s->error = 1;
+    if (got == 0 && t->inner->error) s->error = 1;
+    return got;
+}
+
+static void tee_stream_close(InStream *s) {
+    (void)s;    // 嵌在调用者栈上，无需释放
+}
+
+void tee_stream_init(TeeStream *t, InStream *inner, FILE *copy) {
+    memset(t, 0, sizeof(*t));
+    t->base.read = tee_stream_read;
+    t->base.close = tee_stream_close;
+    t->inner = inner;
+    t->copy = copy;
+}
+
+/* ---- 前缀：先返回已经读出的头部字节，再接着读下层流 ---- */
+typedef struct {
+    InStream       base;
+    InStream      *inner;
+    const uint8_t *head;
+    size_t         head_len;
+    size_t         pos;
+} PrefixStream;
+
+static size_t prefix_stream_read(InStream *s, void *buf, size_t n) {
+    PrefixStream *p = (PrefixStream *)s;
+    if (p->pos < p->head_len) {
+        size_t take = p->head_len - p->pos;
+        if (take > n) take = n;
+        memcpy(buf, p->head + p->pos, take);
+        p->pos += take;
+        return take;
+    }
+    size_t got = p->inner->read(p->inner, buf, n);
+    if (got == 0 && p->inner->error) s->error = 1;
+    return got;
+}
+
+static void prefix_stream_close(InStream *s) {
+    (void)s;    // 嵌在调用者栈上，无需释放
+}
+
+void prefix_stream_init(PrefixStream *p, InStream *inner, const uint8_t *head, size_t head_len) {
+    memset(p, 0, sizeof(*p));
+    p->base.read = prefix_stream_read;
+    p->base.close = prefix_stream_close;
+    p->inner = inner;
+    p->head = head;
+    p->head_len = head_len;
+}
+
+#ifndef _WIN32
+/* ---- 文件描述符（外部解压程序的标准输出管道） ---- */
+typedef struct {
+    InStream base;
+    int      fd;
+} FdStream;
+
+static size_t fd_stream_read(InStream *s, void *buf, size_t n) {
+    FdStream *f = (FdStream *)s;
+    for (;;) {
+        ssize_t got = read(f->fd, buf, n);
+        if (got >= 0) return (size_t)got;
+        if (errno != EINTR) {
+            s->error = 1;
+            return 0;
+        }
+    }
+}
+
+static void fd_stream_close(InStream *s) {
+    (void)s;    // 嵌在调用者栈上，描述符由调用者关闭
+}
+
+void fd_stream_init(FdStream *f, int fd) {
+    memset(f, 0, sizeof(*f));
+    f->base.read = fd_stream_read;
+    f->base.close = fd_stream_close;
+    f->fd = fd;
+}
+#endif
+
+/* ---- gzip（zlib，支持 pigz 等生成的多成员文件） ---- */
+typedef struct {
+    InStream  base;
+    InStream *inner;
+    z_stream  zs;
+    int       done;
+    int       members;      // 已完整解出的成员数
+    unsigned char in[STREAM_BUF_SIZE];
+} GzipStream;
+
+static size_t gzip_stream_read(InStream *s, void *buf, size_t n) {
+    GzipStream *g = (GzipStream *)s;
+    if (g->done || n == 0) return 0;
+    if (n > (1u << 30)) n = 1u << 30;
+
+    g->zs.next_out = buf;
+    g->zs.avail_out = (uInt)n;
+    while (g->zs.avail_out > 0) {
+        if (g->zs.avail_in == 0) {
+            size_t got = g->inner->read(g->inner, g->in, sizeof(g->in));
+            if (got == 0) {
+                // 成员中途结束视为截断
+                if (g->inner->error || g->zs.total_in > 0 || g->members == 0) s->error = 1;
+                g->done = 1;
+                break;
+            }
+            g->zs.next_in = g->in;
+            g->zs.avail_in = (uInt)got;
+        }
+        int ret = inflate(&g->zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            g->members++;
+            inflateReset(&g->zs);   // 后面可能还有下一个成员
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            // 最后一个成员后的填充字节不算错误
+            if (g->members == 0 || g->zs.total_in > 0) s->error = 1;
+            g->done = 1;
+            break;
+        }
+    }
+    return n - g->zs.avail_out;
+}
+
+static void gzip_stream_close(InStream *s) {
+    GzipStream *g = (GzipStream *)s;
+    inflateEnd(&g->zs);
+    free(g);
+}
+
+static InStream *gzip_seq_open(InStream *inner) {
+    GzipStream *g = calloc(1, sizeof(GzipStream));
+    if (!g) return NULL;
+    if (inflateInit2(&g->zs, 15 + 32) != Z_OK) {    // 自动识别 gzip / zlib 头
+        free(g);
+        return NULL;
+    }
+    g->base.read = gzip_stream_read;
+    g->base.close = gzip_stream_close;
+    g->inner = inner;
+    return &g->base;
+}
+
+/* ---- bzip2（支持 pbzip2 生成的多流文件） ---- */
+typedef struct {
+    InStream  base;
+    InStream *inner;
+    bz_stream bs;
+    int       done;
+    int       members;
+    int       in_member;
+    char      in[STREAM_BUF_SIZE];
+} Bzip2Stream;
+
+static size_t bzip2_stream_read(InStream *s, void *buf, size_t n) {
+    Bzip2Stream *b = (Bzip2Stream *)s;
+    if (b->done || n == 0) return 0;
+    if (n > (1u << 30)) n = 1u << 30;
+
+    b->bs.next_out = buf;
+    b->bs.avail_out = (unsigned)n;
+    while (b->bs.avail_out > 0) {
+        if (b->bs.avail_in == 0) {
+            size_t got = b->inner->read(b->inner, b->in, sizeof(b->in));
+            if (got == 0) {
+                if (b->inner->error || b->in_member || b->members == 0) s->error = 1;
+                b->done = 1;
+                break;
+            }
+            b->bs.next_in = b->in;
+            b->bs.avail_in = (unsigned)got;
+        }
+        int ret = BZ2_bzDecompress(&b->bs);
+        if (ret == BZ_STREAM_END) {
+            b->members++;
+            b->in_member = 0;
+            // 重新初始化以继续解下一个流，保留尚未消耗的输入
+            char *next_in = b->bs.next_in;
+            unsigned avail_in = b->bs.avail_in;
+            char *next_out = b->bs.next_out;
+            unsigned avail_out = b->bs.avail_out;
+            BZ2_bzDecompressEnd(&b->bs);
+            memset(&b->bs, 0, sizeof(b->bs));
+            if (BZ2_bzDecompressInit(&b->bs, 0, 0) != BZ_OK) {
+                s->error = 1;
+                b->done = 1;
+                break;
+            }
+            b->bs.next_in = next_in;
+            b->bs.avail_in = avail_in;
+            b->bs.next_out = next_out;
+            b->bs.avail_out = avail_out;
+            continue;
+        }
+        if (ret != BZ_OK) {
+            if (b->members == 0 || b->in_member) s->error = 1;
+            b->done = 1;
+            break;
+        }
+        b->in_member = 1;
+    }
+    return n - b->bs.avail_out;
+}
+
+static void bzip2_stream_close(InStream *s) {
+    Bzip2Stream *b = (Bzip2Stream *)s;
+    BZ2_bzDecompressEnd(&b->bs);
+    free(b);
+}
+
+InStream *bzip2_stream_open(InStream *inner) {
+    Bzip2Stream *b = calloc(1, sizeof(Bzip2Stream));
+    if (!b) return NULL;
+    if (BZ2_bzDecompressInit(&b->bs, 0, 0) != BZ_OK) {
+        free(b);
+        return NULL;
+    }
+    b->base.read = bzip2_stream_read;
+    b->base.close = bzip2_stream_close;
+    b->inner = inner;
+    return &b->base;
+}
+
+/* ---- xz（liblzma，LZMA_CONCATENATED 处理多流文件） ---- */
+typedef struct {
+    InStream    base;
+    InStream   *inner;
+    lzma_stream ls;
+    int         done;
+    int         eof;
+    uint8_t     in[STREAM_BUF_SIZE];
+} XzStream;
+
+static size_t xz_stream_read(InStream *s, void *buf, size_t n) {
+    XzStream *x = (XzStream *)s;
+    if (x->done || n == 0) return 0;
+
+    x->ls.next_out = buf;
+    x->ls.avail_out = n;
+    while (x->ls.avail_out > 0) {
+        if (x->ls.avail_in == 0 && !x->eof) {
+            size_t got = x->inner->read(x->inner, x->in, sizeof(x->in));
+            if (got == 0) {
+                if (x->inner->error) s->error = 1;
+                x->eof = 1;
+            }
+            x->ls.next_in = x->in;
+            x->ls.avail_in = got;
+        }
+        lzma_ret ret = lzma_code(&x->ls, x->eof ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_STREAM_END) {
+            x->done = 1;
+            break;
+        }
+        if (ret != LZMA_OK) {
+            s->error = 1;
+            x->done = 1;
+            break;
+        }
+    }
+    return n - x->ls.avail_out;
+}
+
+static void xz_stream_close(InStream *s) {
+    XzStream *x = (XzStream *)s;
+    lzma_end(&x->ls);
+    free(x);
+}
+
+InStream *xz_stream_open(InStream *inner) {
+    XzStream *x = calloc(1, sizeof(XzStream));
+    if (!x) return NULL;
+    lzma_stream init = LZMA_STREAM_INIT;
+    x->ls = init;
+    lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+    // xz -T 生成的多块文件块头里记有大小，多线程解码器按块并行；单块文件会自动退回单线程
+    if (pool_parallel()) {
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = (uint32_t)pool_threads();
+        mt.memlimit_threading = lzma_physmem() / 4;
+        mt.memlimit_stop = UINT64_MAX;
+        ret = lzma_stream_decoder_mt(&x->ls, &mt);
+    } else
+#endif
+    ret = lzma_stream_decoder(&x->ls, UINT64_MAX, LZMA_CONCATENATED);
+    if (ret != LZMA_OK) {
+        free(x);
+        return NULL;
+    }
+    x->base.read = xz_stream_read;
+    x->base.close = xz_stream_close;
+    x->inner = inner;
+    return &x->base;
+}
+
+#ifdef HAVE_ZSTD
+/* ---- zstd（可选，编译时定义 HAVE_ZSTD 并链接 -lzstd） ---- */
+typedef struct {
+    InStream       base;
+    InStream      *inner;
+    ZSTD_DStream  *ds;
+    ZSTD_inBuffer  zin;
+    int            done;
+    int            in_frame;
+    uint8_t        in[STREAM_BUF_SIZE];
+} ZstdStream;
+
+static size_t zstd_stream_read(InStream *s, void *buf, size_t n) {
+    ZstdStream *z = (ZstdStream *)s;
+    if (z->done || n == 0) return 0;
+
+    ZSTD_outBuffer out = { buf, n, 0 };
+    while (out.pos < out.size) {
+        if (z->zin.pos == z->zin.size) {
+            size_t got = z->inner->read(z->inner, z->in, sizeof(z->in));
+            if (got == 0) {
+                if (z->inner->error || z->in_frame) s->error = 1;
+                z->done = 1;
+                break;
+            }
+            z->zin.src = z->in;
+            z->zin.size = got;
+            z->zin.pos = 0;
+        }
+        size_t ret = ZSTD_decompressStream(z->ds, &out, &z->zin);
+        if (ZSTD_isError(ret)) {
+            s->error = 1;
+            z->done = 1;
+            break;
+        }
+        z->in_frame = (ret != 0);    // 0 表示一个帧刚好结束
+    }
+    return out.pos;
+}
+
+static void zstd_stream_close(InStream *s) {
+    ZstdStream *z = (ZstdStream *)s;
+    ZSTD_freeDStream(z->ds);
+    free(z);
+}
+
+static InStream *zstd_seq_open(InStream *inner) {
+    ZstdStream *z = calloc(1, sizeof(ZstdStream));
+    if (!z) return NULL;
+    z->ds = ZSTD_createDStream();
+    if (!z->ds) {
+        free(z);
+        return NULL;
+    }
+    ZSTD_initDStream(z->ds);
+    z->base.read = zstd_stream_read;
+    z->base.close = zstd_stream_close;
+    z->inner = inner;
+    return &z->base;
+}
+#endif
+
+/* ---- 并行解码：多成员 gzip、多帧 zstd 按单元分给线程池 ---- */
+// bgzip、分块压缩后拼接的 gzip、zstd -T 等生成的文件由多个可以独立解码的单元组成。
+// 读取方顺序读入压缩数据并切出单元，同时最多有 nthreads + 1 个单元在线程池里解压，
+// 解出的数据仍按输入顺序交给上层。某个单元解不出（候选边界不对、单元过大、数据损坏）时，
+// 从这个单元开始把剩下的数据交给原来的顺序解码器，结果和报错与顺序解码完全一致。
+// pigz 默认只生成一个成员，只能顺序解码。
+#define PAR_READ_SIZE   (1u << 20)      // 每次从下层流读入的压缩数据
+#define PAR_UNIT_MAX    (4u << 20)      // 单元压缩后的大小上限，更大的单元顺序解码
+#define PAR_OUT_MAX     (32u << 20)     // 单元解出的大小上限，超过时顺序解码（配额照常检查）
+
+typedef struct ParUnit {
+    struct ParUnit *next;
+    int             format;
+    int             last;       // 输入中的最后一个单元
+    uint8_t        *in;
+    size_t          in_len;
+    uint8_t        *out;
+    size_t          out_len;
+    int             ok;
+    TaskGroup       group;
+} ParUnit;
+
+typedef struct {
+    InStream      base;
+    InStream     *inner;
+    int           format;
+    InStream   *(*seq_open)(InStream *inner);
+    uint8_t      *buf;          // 已读入、尚未切分的压缩数据为 [start, len)
+    size_t        start, len, cap;
+    int           eof;          // 下层流已读完
+    int           inner_error;
+    int           split_done;   // 不再切分，[start, len) 和下层流留给顺序解码器
+    ParUnit      *head, *tail;  // 已提交的单元，按输入顺序
+    int           inflight;
+    int           window;
+    int           done_units;   // 已完整交出的单元数
+    size_t        pos;          // head 中已返回的字节
+    InStream     *seq;          // 退回顺序解码后的解码器
+    uint8_t      *rest;         // 顺序解码器先读的压缩数据
+    PrefixStream  prefix;
+} ParStream;
+
+// gzip 成员头：1f 8b 08，FLG 保留位为 0，XFL 与 OS 取值合理
+static int gzip_member_head(const uint8_t *b) {
+    return b[0] == 0x1F && b[1] == 0x8B && b[2] == 8 && (b[3] & 0xE0) == 0 &&
+           (b[8] == 0 || b[8] == 2 || b[8] == 4) && (b[9] <= 13 || b[9] == 255);
+}
+
+// 下一个 gzip 成员的长度：0 表示需要更多数据，(size_t)-1 表示无法切分
+static size_t gzip_unit_split(const uint8_t *b, size_t n, int eof) {
+    if (n < 20) return eof && n > 0 ? ((n >= 10 && gzip_member_head(b)) ? n : (size_t)-1) : 0;
+    if (!gzip_member_head(b)) return (size_t)-1;
+
+    // BGZF：扩展字段 BC 给出成员的确切大小
+    if (b[3] & 4) {
+        size_t xlen = b[10] | (size_t)b[11] << 8;
+        for (size_t i = 12; i + 4 <= 12 + xlen && i + 4 <= n; ) {
+            size_t slen = b[i + 2] | (size_t)b[i + 3] << 8;
+            if (b[i] == 'B' && b[i + 1] == 'C' && slen == 2 && i + 6 <= n) {
+                size_t bsize = (b[i + 4] | (size_t)b[i + 5] << 8) + 1;
+                if (bsize <= n) return bsize;
+                return eof ? (size_t)-1 : 0;
+            }
+            i += 4 + slen;
+        }
+    }
+
+    // 其他情况找下一个成员头；压缩数据里偶然出现的成员头会让这个单元解不出，届时退回顺序解码
+    size_t limit = n < PAR_UNIT_MAX ? n : PAR_UNIT_MAX;
+    for (size_t i = 20; i + 10 <= limit; i++) {
+        const uint8_t *c = memchr(b + i, 0x1F, limit - 10 + 1 - i);
+        if (!c) break;
+        i = (size_t)(c - b);
+        if (gzip_member_head(c)) return i;
+    }
+    if (n >= PAR_UNIT_MAX) return (size_t)-1;
+    return eof ? n : 0;
+}
+
+// 解压一个 gzip 成员；成员必须恰好在单元末尾结束（最后一个单元允许有非成员头的填充）
+static int gzip_unit_decode(ParUnit *u) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) return 0;
+    zs.next_in = u->in;
+    zs.avail_in = (uInt)u->in_len;
+
+    // 尾部的 ISIZE 是解出大小的低 32 位，用来定初始容量
+    size_t cap = 0;
+    if (u->in_len >= 20) {
+        const uint8_t *t = u->in + u->in_len - 4;
+        cap = (size_t)t[0] | (size_t)t[1] << 8 | (size_t)t[2] << 16 | (size_t)t[3] << 24;
+    }
+    if (cap == 0 || cap > PAR_OUT_MAX) cap = STREAM_BUF_SIZE;
+    int ok = 0;
+    for (;;) {
+        if (u->out_len == cap || !u->out) {
+            if (u->out) {
+                if (cap >= PAR_OUT_MAX) break;
+                cap = cap * 2 > PAR_OUT_MAX ? PAR_OUT_MAX : cap * 2;
+            }
+            uint8_t *grown = realloc(u->out, cap);
+            if (!grown) break;
+            u->out = grown;
+        }
+        zs.next_out = u->out + u->out_len;
+        zs.avail_out = (uInt)(cap - u->out_len);
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        u->out_len = cap - zs.avail_out;
+        if (ret == Z_STREAM_END) {
+            ok = zs.avail_in == 0 ||
+                 (u->last && !(zs.avail_in >= 2 && zs.next_in[0] == 0x1F && zs.next_in[1] == 0x8B));
+            break;
+        }
+        if (ret == Z_BUF_ERROR && zs.avail_out > 0) break;     // 单元在成员中途结束
+        if (ret != Z_OK && ret != Z_BUF_ERROR) break;
+    }
+    inflateEnd(&zs);
+    return ok;
+}
+
+#ifdef HAVE_ZSTD
+// 下一个 zstd 帧（含可跳过帧）的长度
+static size_t zstd_unit_split(const uint8_t *b, size_t n, int eof) {
+    size_t len = ZSTD_findFrameCompressedSize(b, n < PAR_UNIT_MAX ? n : PAR_UNIT_MAX);
+    if (!ZSTD_isError(len)) return len;
+    return (eof || n >= PAR_UNIT_MAX) ? (size_t)-1 : 0;
+}
+
+static int zstd_unit_decode(ParUnit *u) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    if (!ds) return 0;
+    ZSTD_initDStream(ds);
+    unsigned long long size = ZSTD_getFrameContentSize(u->in, u->in_len);
+    size_t cap = (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR ||
+                  size == 0 || size > PAR_OUT_MAX) ? STREAM_BUF_SIZE : (size_t)size;
+    ZSTD_inBuffer zin = { u->in, u->in_len, 0 };
+    int ok = 0;
+    for (;;) {
+        if (u->out_len == cap || !u->out) {
+            if (u->out) {
+                if (cap >= PAR_OUT_MAX) break;
+                cap = cap * 2 > PAR_OUT_MAX ? PAR_OUT_MAX : cap * 2;
+            }
+            uint8_t *grown = realloc(u->out, cap);
+            if (!grown) break;
+            u->out = grown;
+        }
+        ZSTD_outBuffer out = { u->out, cap, u->out_len };
+        size_t ret = ZSTD_decompressStream(ds, &out, &zin);
+        u->out_len = out.pos;
+        if (ZSTD_isError(ret)) break;
+        if (ret == 0) {
+            ok = zin.pos == zin.size;
+            break;
+        }
+        if (zin.pos == zin.size && out.pos < out.size) break;  // 帧不完整
+    }
+    ZSTD_freeDStream(ds);
+    return ok;
+}
+#endif
+
+static void par_unit_task(void *arg) {
+    ParUnit *u = arg;
+#ifdef HAVE_ZSTD
+    if (u->format == FMT_ZSTD) {
+        u->ok = zstd_unit_decode(u);
+        return;
+    }
+#endif
+    u->ok = gzip_unit_decode(u);
+}
+
+static void par_unit_free(ParUnit *u) {
+    task_group_wait(&u->group);
+    free(u->in);
+    free(u->out);
+    free(u);
+}
+
+// 读入更多压缩数据，下层流结束时返回 0
+static int par_fill(ParStream *p) {
+    if (p->eof) return 0;
+    if (p->start == p->len) {
+        p->start = p->len = 0;
+    } else if (p->start > 0 && p->start >= p->len / 2) {
+        memmove(p->buf, p->buf + p->start, p->len - p->start);
+        p->len -= p->start;
+        p->start = 0;
+    }
+    if (p->cap - p->len < PAR_READ_SIZE) {
+        uint8_t *grown = realloc(p->buf, p->len + PAR_READ_SIZE);
+        if (!grown) {
+            p->inner_error = 1;
+            p->eof = 1;
+            return 0;
+        }
+        p->buf = grown;
+        p->cap = p->len + PAR_READ_SIZE;
+    }
+    size_t got = p->inner->read(p->inner, p->buf + p->len, PAR_READ_SIZE);
+    if (got == 0) {
+        if (p->inner->error) p->inner_error = 1;
+        p->eof = 1;
+        return 0;
+    }
+    p->len += got;
+    return 1;
+}
+
+// 切出下一个单元并提交解压，没有可提交的单元时返回 0
+static int par_submit_next(ParStream *p) {
+    for (;;) {
+        if (p->split_done) return 0;
+        if (p->eof && p->start == p->len) {
+            p->split_done = 1;
+            return 0;
+        }
+        size_t n = p->len - p->start;
+        size_t unit = 0;
+        if (n > 0) {
+#ifdef HAVE_ZSTD
+            if (p->format == FMT_ZSTD) unit = zstd_unit_split(p->buf + p->start, n, p->eof);
+            else
+#endif
+            unit = gzip_unit_split(p->buf + p->start, n, p->eof);
+        }
+        if (unit == (size_t)-1 || p->inner_error) {
+            p->split_done = 1;
+            return 0;
+        }
+        if (unit == 0) {
+            par_fill(p);
+            continue;
+        }
+
+        ParUnit *u = calloc(1, sizeof(ParUnit));
+        uint8_t *in = u ? malloc(unit) : NULL;
+        if (!in) {
+            free(u);
+            p->split_done = 1;
+            return 0;
+        }
+        memcpy(in, p->buf + p->start, unit);
+        p->start += unit;
+        u->format = p->format;
+        u->in = in;
+        u->in_len = unit;
+        u->last = p->eof && p->start == p->len;
+        if (p->tail) p->tail->next = u;
+        else p->head = u;
+        p->tail = u;
+        p->inflight++;
+        task_submit(&u->group, par_unit_task, u);
+        return 1;
+    }
+}
+
+// 从 head 开始退回顺序解码：未解出的单元和尚未切分的数据依次放在下层流前面
+static void par_fallback(ParStream *p) {
+    size_t total = p->len - p->start;
+    for (ParUnit *u = p->head; u; u = u->next) total += u->in_len;
+    p->rest = malloc(total ? total : 1);
+    size_t off = 0;
+    while (p->head) {
+        ParUnit *u = p->head;
+        p->head = u->next;
+        if (p->rest) memcpy(p->rest + off, u->in, u->in_len);
+        off += u->in_len;
+        par_unit_free(u);
+    }
+    p->tail = NULL;
+    p->inflight = 0;
+    if (p->rest) memcpy(p->rest + off, p->buf + p->start, p->len - p->start);
+    free(p->buf);
+    p->buf = NULL;
+    p->start = p->len = p->cap = 0;
+    p->split_done = 1;
+    if (!p->rest) {
+        p->base.error = 1;
+        return;
+    }
+    prefix_stream_init(&p->prefix, p->inner, p->rest, total);
+    p->seq = p->seq_open(&p->prefix.base);
+    if (!p->seq) p->base.error = 1;
+}
+
+static size_t par_stream_read(InStream *s, void *buf, size_t n) {
+    ParStream *p = (ParStream *)s;
+    for (;;) {
+        if (p->seq) {
+            size_t got = p->seq->read(p->seq, buf, n);
+            if (got == 0 && p->seq->error) s->error = 1;
+            return got;
+        }
+        if (s->error || n == 0) return 0;
+
+        while (p->inflight < p->window && par_submit_next(p)) {
+        }
+        ParUnit *u = p->head;
+        if (!u) {
+            // 一个单元都没解出时（空输入、不是 gzip 头等）由顺序解码器决定结果
+            if (p->split_done && (p->start < p->len || !p->eof || p->done_units == 0)) {
+                par_fallback(p);
+                continue;
+            }
+            if (p->inner_error) s->error = 1;
+            return 0;
+        }
+        task_group_wait(&u->group);
+        if (!u->ok) {
+            par_fallback(p);
+            continue;
+        }
+        if (p->pos < u->out_len) {
+            size_t take = u->out_len - p->pos;
+            if (take > n) take = n;
+            memcpy(buf, u->out + p->pos, take);
+            p->pos += take;
+            return take;
+        }
+        p->head = u->next;
+        if (!p->head) p->tail = NULL;
+        p->inflight--;
+        p->done_units++;
+        p->pos = 0;
+        par_unit_free(u);
+    }
+}
+
+static void par_stream_close(InStream *s) {
+    ParStream *p = (ParStream *)s;
+    while (p->head) {
+        ParUnit *u = p->head;
+        p->head = u->next;
+        par_unit_free(u);
+    }
+    stream_close(p->seq);
+    free(p->rest);
+    free(p->buf);
+    free(p);
+}
+
+static InStream *par_stream_open(InStream *inner, int format, InStream *(*seq_open)(InStream *inner)) {
+    ParStream *p = calloc(1, sizeof(ParStream));
+    if (!p) return NULL;
+    p->base.read = par_stream_read;
+    p->base.close = par_stream_close;
+    p->inner = inner;
+    p->format = format;
+    p->seq_open = seq_open;
+    p->window = pool_threads() + 1;
+    return &p->base;
+}
+
+// -j N 时按单元并行解压，否则直接用顺序解码器
+InStream *gzip_stream_open(InStream *inner) {
+    if (pool_parallel()) return par_stream_open(inner, FMT_GZIP, gzip_seq_open);
+    return gzip_seq_open(inner);
+}
+
+#ifdef HAVE_ZSTD
+InStream *zstd_stream_open(InStream *inner) {
+    if (pool_parallel()) return par_stream_open(inner, FMT_ZSTD, zstd_seq_open);
+    return zstd_seq_open(inner);
+}
+#endif
+
+/* ---- 解压器表：按后缀选择，越长的后缀越靠前 ---- */
+static const DecoderEntry decoder_tbl[] = {
+    {".tar.gz",  7, ARCHIVE_TAR,    gzip_stream_open},
+    {".tgz",     4, ARCHIVE_TAR,    gzip_stream_open},
+    {".tar.bz2", 8, ARCHIVE_TAR,    bzip2_stream_open},
+    {".tbz2",    5, ARCHIVE_TAR,    bzip2_stream_open},
+    {".tar.xz",  7, ARCHIVE_TAR,    xz_stream_open},
+    {".txz",     4, ARCHIVE_TAR,    xz_stream_open},
+#ifdef HAVE_ZSTD
+    {".tar.zst", 8, ARCHIVE_TAR,    zstd_stream_open},
+    {".tzst",    5, ARCHIVE_TAR,    zstd_stream_open},
+#endif
+    {".tar",     4, ARCHIVE_TAR,    NULL},
+    {".gz",      3, ARCHIVE_SINGLE, gzip_stream_open},
+    {".bz2",     4, ARCHIVE_SINGLE, bzip2_stream_open},
+    {".xz",      3, ARCHIVE_SINGLE, xz_stream_open},
+#ifdef HAVE_ZSTD
+    {".zst",     4, ARCHIVE_SINGLE, zstd_stream_open},
+#endif
+    {NULL, 0, ARCHIVE_TAR, NULL}
+};
+
+// 查找能在进程内处理的解压器，找不到返回 NULL（交给外部命令）
+const DecoderEntry *find_decoder(const char *filename) {
+    size_t len = strlen(filename);
+    for (int i = 0; decoder_tbl[i].suffix; i++) {
+        const DecoderEntry *d = &decoder_tbl[i];
+        if (len >= d->suffix_len && strcmp(filename + len - d->suffix_len, d->suffix) == 0)
+            return d;
+    }
+    return NULL;
+}
+
+// 后缀与内容不符时使用的解压器：解出的单个文件保持原名
+static const DecoderEntry format_decoders[] = {
+    {"", 0, ARCHIVE_TAR,    NULL},              // FMT_TAR
+    {"", 0, ARCHIVE_SINGLE, gzip_stream_open},  // FMT_GZIP
+    {"", 0, ARCHIVE_SINGLE, bzip2_stream_open}, // FMT_BZIP2
+    {"", 0, ARCHIVE_SINGLE, xz_stream_open},    // FMT_XZ
+#ifdef HAVE_ZSTD
+    {"", 0, ARCHIVE_SINGLE, zstd_stream_open},  // FMT_ZSTD
+#endif
+};
+
+// 按识别出的格式选择解压器，后缀只用来区分 .tar.gz 与 .gz 这类情况；需要外部命令时返回 NULL
+const DecoderEntry *decoder_for_format(int format, const char *filename) {
+    if (format < FMT_TAR || format - FMT_TAR >= (int)(sizeof(format_decoders) / sizeof(format_decoders[0])))
+        return NULL;
+    const DecoderEntry *fallback = &format_decoders[format - FMT_TAR];
+    const DecoderEntry *d = find_decoder(filename);
+    if (d && d->open == fallback->open) return d;
+    return fallback;
+}
+
+/*========== 4. tar 流式读取 ==========*/
+#define TAR_BLOCK     512
+#define TAR_NAME_MAX  4096
+
+struct TarReader {
+    InStream *in;
+    InStream  member;                   // 当前成员的数据流
+    uint64_t  remain;                   // 当前成员剩余数据
+    uint64_t  pad;                      // 当前成员数据后的块对齐填充
+    char      next_name[TAR_NAME_MAX];  // GNU 'L' / pax path 指定的下一个成员名
+    uint64_t  next_size;                // pax size 指定的下一个成员大小
+    int       has_next_name;
+    int       has_next_size;
+};
+
+typedef struct {
+    char      name[TAR_NAME_MAX];       // 成员在包内的完整路径
+    uint64_t  size;
+    unsigned  mode;
+    char      type;                     // '0' 普通文件，'5' 目录，其余见 ustar 规范
+} TarEntry;
+
+// 解析八进制数字段（GNU 大文件使用 base-256 编码，首字节最高位为 1）
+static uint64_t tar_parse_number(const uint8_t *p, size_t len) {
+    uint64_t v = 0;
+    if (p[0] & 0x80) {
+        v = p[0] & 0x7F;
+        for (size_t i = 1; i < len; i++) v = (v << 8) | p[i];
+        return v;
+    }
+    size_t i = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\0')) i++;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) v = (v << 3) | (uint64_t)(p[i] - '0');
+    return v;
+}
+
+// 校验头部校验和（兼容把字节当作有符号数求和的老实现）
+static int tar_checksum_ok(const uint8_t *hdr) {
+    uint64_t want = tar_parse_number(hdr + 148, 8);
+    long usum = 0, ssum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        uint8_t c = (i >= 148 && i < 156) ? ' ' : hdr[i];
+        usum += c;
+        ssum += (signed char)c;
+    }
+    return (uint64_t)usum == want || (uint64_t)ssum == want;
+}
+
+// 按头部字节识别压缩包格式，扩展名只作辅助：
+// 魔数属于压缩包、但扩展名是该魔数允许的非压缩包格式（如 zip 之于 .docx/.jar）时不当作压缩包
+int sniff_archive(const uint8_t *buf, size_t n, const char *filename) {
+    if (n >= TAR_BLOCK && buf[0] != '\0' && tar_checksum_ok(buf)) return FMT_TAR;
+
+    const MagicEntry *m = magic_lookup(buf, n);
+    if (!m || m->format == FMT_NONE) return FMT_NONE;
+
+    const char *ext = strrchr(filename, '.');
+    if (ext && !is_archive_file(filename)) {
+        for (int k = 0; m->exts[k]; ++k) {
+            if (extcasecmp(ext, m->exts[k]) == 0) return FMT_NONE;
+        }
+    }
+    return m->format;
+}
+
+// 读文件头识别压缩包格式
+int sniff_archive_file(const char *path, const char *filename) {
+    uint8_t buf[MAGIC_HEAD_SIZE];
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return FMT_NONE;
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return sniff_archive(buf, n, filename);
+}
+
+// 读取并丢弃 n 字节
+static int tar_discard(TarReader *tr, uint64_t n) {
+    char buf[4096];
+    while (n > 0) {
+        size_t want = n < sizeof(buf) ? (size_t)n : sizeof(buf);
+        if (stream_read_full(tr->in, buf, want) != want) return -1;
+        n -= want;
+    }
+    return 0;
+}
+
+// 解析 pax 扩展头中的 path / size 记录（格式："长度 key=value\n"）
+static void tar_parse_pax(TarReader *tr, const char *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        char *end;
+        unsigned long rec_len = strtoul(data + pos, &end, 10);
+        if (rec_len == 0 || pos + rec_len > len || *end != ' ') break;
+        const char *key = end + 1;
+        const char *rec_end = data + pos + rec_len - 1;     // 指向结尾的 '\n'
+        const char *eq = memchr(key, '=', (size_t)(rec_end - key));
+        if (eq) {
+            size_t vlen = (size_t)(rec_end - eq - 1);
+            if ((size_t)(eq - key) == 4 && strncmp(key, "path", 4) == 0 && vlen < TAR_NAME_MAX) {
+                memcpy(tr->next_name, eq + 1, vlen);
+                tr->next_name[vlen] = '\0';
+                tr->has_next_name = 1;
+            } else if ((size_t)(eq - key) == 4 && strncmp(key, "size", 4) == 0) {
+                tr->next_size = strtoull(eq + 1, NULL, 10);
+                tr->has_next_size = 1;
+            }
+        }
+        pos += rec_len;
+    }
+}
+
+// 读取下一个成员头。返回 1 表示得到成员，0 表示归档结束，-1 表示格式错误
+static int tar_next(TarReader *tr, TarEntry *te) {
+    uint8_t hdr[TAR_BLOCK];
+
+    // 跳过上一个成员未读完的数据
+    if (tar_discard(tr, tr->remain + tr->pad) != 0) return -1;
+    tr->remain = tr->pad = 0;
+    tr->member.error = 0;
+
+    for (;;) {
+        size_t n = stream_read_full(tr->in, hdr, TAR_BLOCK);
+        if (n == 0) return tr->in->error ? -1 : 0;  // 缺少结束块也当作正常结束
+        if (n != TAR_BLOCK) return -1;
+
+        int zero = 1;
+        for (int i = 0; i < TAR_BLOCK && zero; i++) zero = (hdr[i] == 0);
+        if (zero) return 0;
+
+        if (!tar_checksum_ok(hdr)) return -1;
+
+        uint64_t size = tar_parse_number(hdr + 124, 12);
+        uint64_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+        char type = (char)hdr[156];
+
+        // 元数据成员：GNU 长文件名、pax 扩展头
+        if (type == 'L' || type == 'K' || type == 'x' || type == 'g') {
+            if (size > (1u << 20)) return -1;
+            char *data = malloc((size_t)size + 1);
+            if (!data) return -1;
+            if (stream_read_full(tr->in, data, (size_t)size) != size || tar_discard(tr, pad) != 0) {
+                free(data);
+                return -1;
+            }
+            data[size] = '\0';
+            if (type == 'L') {
+                strncpy(tr->next_name, data, TAR_NAME_MAX - 1);
+                tr->next_name[TAR_NAME_MAX - 1] = '\0';
+                tr->has_next_name = 1;
+            } else if (type == 'x') {
+                tar_parse_pax(tr, data, (size_t)size);
+            }
+            free(data);
+            continue;
+        }
+
+        if (tr->has_next_name) {
+            strcpy(te->name, tr->next_name);
+        } else if (memcmp(hdr + 257, "ustar", 5) == 0 && hdr[345] != '\0') {
+            // ustar 的 prefix 字段（155 字节）+ name 字段（100 字节）
+            snprintf(te->name, sizeof(te->name), "%.155s/%.100s", (const char *)hdr + 345, (const char *)hdr);
+        } else {
+            snprintf(te->name, sizeof(te->name), "%.100s", (const char *)hdr);
+        }
+        if (tr->has_next_size) {
+            size = tr->next_size;
+            pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+        }
+        tr->has_next_name = tr->has_next_size = 0;
+
+        te->type = type ? type : '0';
+        te->mode = (unsigned)tar_parse_number(hdr + 100, 8);
+
+        // 链接、设备、目录等成员没有数据
+        if (te->type >= '1' && te->type <= '6') size = pad = 0;
+        te->size = size;
+        tr->remain = size;
+        tr->pad = pad;
+        return 1;
+    }
+}
+
+// 读取当前成员数据（TarReader.member 的读函数）
+static size_t tar_member_read(InStream *s, void *buf, size_t n) {
+    TarReader *tr = (TarReader *)((char *)s - offsetof(TarReader, member));
+    if (n > tr->remain) n = (size_t)tr->remain;
+    if (n == 0) return 0;
+    size_t got = tr->in->read(tr->in, buf, n);
+    if (got == 0) s->error = 1;     // 成员数据被截断
+    tr->remain -= got;
+    return got;
+}
+
+static void tar_member_close(InStream *s) {
+    (void)s;
+}
+
+// 把成员数据写入指定目录（带路径前缀），head 为已经读出的头部字节
+int extract_entry_with_path(InStream *data, const uint8_t *head, size_t head_len, const char *src_name,
+                            const char *dest_dir, const char *reason, const char *relative_path,
+                            char *dest_path, size_t dest_size, uint8_t digest[32]) {
+    const char *filename = get_filename(src_name);
+    if (!make_dest_path(dest_path, dest_size, dest_dir, filename, relative_path)) {
+        stream_drain(data);
+        return 0;
+    }
+
+    uint64_t t0 = stats_now();
+    uint8_t *small = NULL;
+#ifdef HAVE_IO_URING
+    // 不会再被读回的小文件（压缩包要接着解，去重要比较已写出的文件）整个读进内存，交给 io_uring 批量写出
+    OutRing *ring = NULL;
+    if (!dedup_enabled() && strcmp(dest_dir, "result/extracted_archives") != 0 && (ring = out_ring_get()) &&
+        (small = malloc(OUT_SMALL_MAX))) {
+        size_t len = head_len;
+        memcpy(small, head, head_len);
+        len += stream_read_full(data, small + len, OUT_SMALL_MAX - len);
+        if (data->error) {
+            log_printf("Waring: truncated archive member %s\n", src_name);
+            free(small);
+            return 0;
+        }
+        if (len < OUT_SMALL_MAX) {
+            const char *type = NULL;
+            int hashed = manifest_enabled();
+            if (hashed) {
+                Sha256 ctx;
+                sha256_init(&ctx);
+                sha256_update(&ctx, small, len);
+                sha256_final(&ctx, digest);
+                type = magic_type_name(small, len);
+            }
+            OutReport report = { reason, dest_dir, type, src_name, relative_path, hashed ? digest : NULL };
+            if (out_ring_write(ring, dest_path, small, len, &report)) {
+                stats_time(ST_COPY, t0);
+                return 1;
+            }
+        }
+        // 大文件：已读出的部分当作头部，走普通写出
+        head = small;
+        head_len = len;
+    }
+#endif
+
+    FILE *dest_file = out_fopen(dest_path);
+    if (!dest_file) {
+        log_printf("Error: Unable to open the source file, %s\n", dest_path);
+        stream_drain(data);
+        free(small);
+        return 0;
+    }
+
+    // 开启去重或写清单时边写边算内容哈希
+    int hashing = dedup_enabled() || manifest_enabled();
+    const char *type = manifest_enabled() ? magic_type_name(head, head_len) : NULL;
+    uint64_t size = head_len;
+    Sha256 ctx;
+    if (hashing) sha256_init(&ctx);
+
+    if (head_len > 0) {
+        fwrite(head, 1, head_len, dest_file);
+        if (hashing) sha256_update(&ctx, head, head_len);
+    }
+
+    char buffer[STREAM_BUF_SIZE];
+    size_t bytes;
+    while ((bytes = data->read(data, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, bytes, dest_file);
+        if (hashing) sha256_update(&ctx, buffer, bytes);
+        size += bytes;
+    }
+#ifndef _WIN32
+    if (out_fsync && fflush(dest_file) == 0) fsync(fileno(dest_file));
+#endif
+    fclose(dest_file);
+    free(small);
+
+    if (data->error) {
+        log_printf("Waring: truncated archive member %s\n", src_name);
+        remove(dest_path);
+        return 0;
+    }
+
+    if (hashing) sha256_final(&ctx, digest);
+    stats_time(ST_COPY, t0);
+    if (dedup_enabled()) {
+        dedup_record_output(dest_dir, reason, relative_path, filename, dest_path, digest);
+        if (dedup_output(digest, dest_path)) {
+            report_output("Linked", reason, src_name, dest_dir, relative_path, filename, dest_path, size, type, digest);
+            return 1;
+        }
+    }
+
+    report_output("Extracted", reason, src_name, dest_dir, relative_path, filename, dest_path, size, type,
+                  hashing ? digest : NULL);
+    return 1;
+}
+
+// 读完一个不写出的成员，out 不为 NULL 时写入临时副本，digest 不为 NULL 时计算内容哈希，返回大小
+static uint64_t drain_entry(InStream *data, const uint8_t *head, size_t head_len, FILE *out, uint8_t digest[32]) {
+    Sha256 ctx;
+    if (digest) sha256_init(&ctx);
+    if (head_len > 0) {
+        if (out) fwrite(head, 1, head_len, out);
+        if (digest) sha256_update(&ctx, head, head_len);
+    }
+    uint64_t size = head_len;
+    char buffer[STREAM_BUF_SIZE];
+    size_t bytes;
+    while ((bytes = data->read(data, buffer, sizeof(buffer))) > 0) {
+        if (out) fwrite(buffer, 1, bytes, out);
+        if (digest) sha256_update(&ctx, buffer, bytes);
+        size += bytes;
+    }
+    if (digest) sha256_final(&ctx, digest);
+    return size;
+}
+
+// --index-only：不写出，只在清单中记录名称、大小和哈希
+static void index_entry(InStream *data, const uint8_t *head, size_t head_len, const char *member,
+                        const char *dest_dir, const char *path_prefix) {
+    uint8_t digest[32];
+    uint64_t size = drain_entry(data, head, head_len, NULL, digest);
+    if (data->error) {
+        log_printf("Waring: truncated archive member %s\n", member);
+        return;
+    }
+    manifest_add("Indexed", dest_dir, path_prefix, get_filename(member), NULL, size,
+                 magic_type_name(head, head_len), digest);
+}
+
+/* ---- 访问者：库调用方逐个查看成员 ---- */
+static struct {
+    tp_visit_fn fn;
+    void       *ctx;
+} g_visit;
+
+struct tp_reader {
+    PrefixStream data;          // 先返回已读出的头部，再接着读成员数据
+    uint64_t     consumed;
+};
+
+size_t tp_read(tp_reader *r, void *buf, size_t n) {
+    size_t got = r->data.base.read(&r->data.base, buf, n);
+    r->consumed += got;
+    return got;
+}
+
+int tp_reader_error(const tp_reader *r) {
+    return r->data.base.error;
+}
+
+// 在筛选之前把成员交给访问者（data 已读出 head 部分）。
+// 返回 1 表示访问者选择跳过，或者读过了头部之后的数据，调用者不再处理这个成员
+static int visit_entry(InStream *data, const uint8_t *head, size_t head_len, const char *path_prefix,
+                       const char *filename, const char *dest_dir, int depth) {
+    if (!g_visit.fn) return 0;
+    tp_entry e = { path_prefix ? path_prefix : "", filename, output_category(dest_dir),
+                   magic_type_name(head, head_len), depth, head, head_len };
+    tp_reader r;
+    memset(&r, 0, sizeof(r));
+    prefix_stream_init(&r.data, data, head, head_len);
+    tls_in_callback++;
+    int ret = g_visit.fn(g_visit.ctx, &e, &r);
+    tls_in_callback--;
+    return ret != TP_CONTINUE || r.consumed > head_len;
+}
+
+static unsigned long next_temp_id(void);
+
+// 分类并输出一个成员（data 为成员数据流，member 为包内路径，path_prefix 为所在目录的路径前缀）
+void process_entry(InStream *data, const char *member, const char *path_prefix, const char *base_extract_dir, int depth, TaskGroup *group) {
+    const char *filename = get_filename(member);
+    char dest_path[2048];
+    uint8_t digest[32];
+
+    // 读出头部字节：按内容识别压缩包和改过扩展名的文件，再连同剩余数据一起写出
+    uint8_t head[MAGIC_HEAD_SIZE];
+    size_t n = stream_read_full(data, head, sizeof(head));
+    uint64_t t0 = stats_now();
+    int format = sniff_archive(head, n, filename);
+    int modified = format == FMT_NONE && !is_c_file(filename) && is_modified_extension_buf(head, n, filename);
+    stats_time(ST_SNIFF, t0);
+
+    const char *dest_dir = format != FMT_NONE ? "result/extracted_archives" :
+                           is_c_file(filename) ? "result/extracted_c_files" :
+                           modified ? "result/extracted_modified_files" : "result/extracted_other_files";
+    if (visit_entry(data, head, n, path_prefix, filename, dest_dir, depth)) {
+        return;                 // 与 FILTER_SKIP 相同，剩余数据由调用者跳过
+    }
+    int action = filter_decide(dest_dir, path_prefix, filename);
+    if (action == FILTER_SKIP) {
+        return;                 // 剩余数据由调用者跳过（tar 在读下一个头时丢弃，zip 成员直接不再解压）
+    }
+    if (format == FMT_NONE && action == FILTER_INDEX) {
+        index_entry(data, head, n, member, dest_dir, path_prefix);
+        return;
+    }
+
+    if (format != FMT_NONE) {
+        const DecoderEntry *dec = decoder_for_format(format, filename);
+        if (dec && !pool_parallel() && !dedup_enabled()) {
+            // 边写副本边解码，嵌套压缩包不再落盘后重读；不保存副本时只解码
+            FILE *copy = NULL;
+            if (action == FILTER_WRITE) {
+                if (!make_dest_path(dest_path, sizeof(dest_path), "result/extracted_archives", filename, path_prefix)) {
+                    stream_drain(data);
+                    return;
+                }
+                copy = out_fopen(dest_path);
+                if (!copy) {
+                    log_printf("Error: Unable to open the source file, %s\n", dest_path);
+                    stream_drain(data);
+                    return;
+                }
+                if (!log_quiet()) log_printf("Extracted %s: %s -> %s\n", "压缩包", member, dest_path);
+            }
+
+            PrefixStream rest;
+            TeeStream tee;
+            Sha256 ctx;
+            prefix_stream_init(&rest, data, head, n);
+            tee_stream_init(&tee, &rest.base, copy);
+            if (manifest_enabled() && action != FILTER_EXPAND) {
+                sha256_init(&ctx);
+                tee.hash = &ctx;
+            }
+            recursive_extract_stream(&tee.base, dec, filename, base_extract_dir, depth, path_prefix);
+            stream_drain(&tee.base);     // 解码器可能没读完，补齐副本
+            if (tee.hash) sha256_final(&ctx, digest);
+            if (copy) {
+                fclose(copy);
+                stats_output("result/extracted_archives", 0, tee.bytes);
+                layout_record(dest_path, path_prefix, filename);
+                manifest_add("Extracted", "result/extracted_archives", path_prefix, filename, dest_path,
+                             tee.bytes, magic_type_name(head, n), tee.hash ? digest : NULL);
+            } else if (tee.hash) {
+                manifest_add("Indexed", "result/extracted_archives", path_prefix, filename, NULL,
+                             tee.bytes, magic_type_name(head, n), digest);
+            }
+        } else if (action != FILTER_WRITE) {
+            // 不保存副本：暂存到临时文件，展开后删除
+            snprintf(dest_path, sizeof(dest_path), "%s_arch_%lu", base_extract_dir, next_temp_id());
+            FILE *spill = fopen(dest_path, "wb");
+            if (!spill) {
+                log_printf("Error: Unable to open the source file, %s\n", dest_path);
+                stream_drain(data);
+                return;
+            }
+            int hashing = dedup_enabled() || action == FILTER_INDEX;
+            uint64_t size = drain_entry(data, head, n, spill, hashing ? digest : NULL);
+            if (fclose(spill) != 0 || data->error) {
+                log_printf("Waring: truncated archive member %s\n", member);
+                remove(dest_path);
+                return;
+            }
+            if (action == FILTER_INDEX)
+                manifest_add("Indexed", "result/extracted_archives", path_prefix, filename, NULL, size,
+                             magic_type_name(head, n), digest);
+            entry_task_submit(group, extract_temp_task, dest_path, filename, base_extract_dir, path_prefix, depth,
+                              dedup_enabled() ? digest : NULL, -1, NULL);
+        } else {
+            // 先提取压缩包本身到archives目录，再从副本解压；并行模式下作为任务与兄弟压缩包同时进行，
+            // 去重模式下先拿到整个压缩包的内容哈希，以便复用相同压缩包的结果
+            if (extract_entry_with_path(data, head, n, member, "result/extracted_archives", "压缩包", path_prefix,
+                                        dest_path, sizeof(dest_path), digest)) {
+                entry_task_submit(group, extract_task, dest_path, filename, base_extract_dir, path_prefix, depth,
+                                  dedup_enabled() ? digest : NULL, -1, NULL);
+            }
+        }
+    } else if (is_c_file(filename)) {
+        extract_entry_with_path(data, head, n, member, "result/extracted_c_files", "C源文件", path_prefix,
+                                dest_path, sizeof(dest_path), digest);
+    } else {
+        if (modified) {
+            extract_entry_with_path(data, head, n, member, "result/extracted_modified_files", "修改扩展名的文件",
+                                    path_prefix, dest_path, sizeof(dest_path), digest);
+        } else {
+            extract_entry_with_path(data, head, n, member, "result/extracted_other_files", "其他文件",
+                                    path_prefix, dest_path, sizeof(dest_path), digest);
+        }
+    }
+}
+
+// 构建成员的路径前缀：current_path 加上包内目录（不包含文件名），在堆上分配，调用方释放
+static char *member_path_prefix(const char *current_path, const char *member) {
+    const char *filename = get_filename(member);
+    size_t dir_len = (size_t)(filename - member);
+    if (dir_len > 0) dir_len--;                          // 去掉末尾的 '/'
+    if (dir_len == 0) return dup_str(current_path ? current_path : "");
+
+    char *dir = malloc(dir_len + 1);
+    if (!dir) return NULL;
+    memcpy(dir, member, dir_len);
+    dir[dir_len] = '\0';
+    char *path_prefix = path_join(current_path, dir);
+    free(dir);
+    return path_prefix;
+}
+
+// 流式处理 tar 包中的成员，直接分类输出，不经过临时目录
+// 返回 1 表示处理完成，0 表示输入不是有效的 tar 包（此时未输出任何成员）
+int process_tar_stream(InStream *in, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path, Budget *budget) {
+    TarReader *tr = calloc(1, sizeof(TarReader));
+    TarEntry *te = malloc(sizeof(TarEntry));
+    if (!tr || !te) {
+        free(tr);
+        free(te);
+        return 0;
+    }
+    tr->in = in;
+    tr->member.read = tar_member_read;
+    tr->member.close = tar_member_close;
+
+    TaskGroup group = { 0 };
+    int count = 0;
+    int rc;
+    while ((rc = tar_next(tr, te)) == 1) {
+        count++;
+        if (budget && !budget_entry(budget)) break;
+        if (te->type != '0' && te->type != '7') continue;   // 只处理普通文件
+
+        // 去掉开头的 "./"，拆出包内目录和文件名
+        const char *member = te->name;
+        while (member[0] == '.' && member[1] == '/') member += 2;
+        char *path_prefix = member_path_prefix(current_path, member);
+        if (!path_prefix) continue;
+
+        process_entry(&tr->member, member, path_prefix, base_extract_dir, depth, &group);
+        free(path_prefix);
+    }
+    task_group_wait(&group);
+
+    if (rc < 0 && !(budget && budget_aborted(budget))) {
+        if (count == 0) {
+            free(tr);
+            free(te);
+            return 0;
+        }
+        log_printf("Waring: damaged tar archive, stop reading: %s\n", archive_name);
+    }
+
+    free(tr);
+    free(te);
+    return 1;
+}
+
+/*========== 5. 线程池（工作窃取） ==========*/
+// -j N 时目录项和嵌套压缩包作为任务提交：每个线程有自己的双端队列，
+// 自己从尾部存取，空闲时从别的线程队列头部窃取。等待任务组的线程也会帮忙执行任务，
+// 因此任务里可以再提交并等待子任务而不会死锁。N <= 1 时任务直接在调用处执行。
+#ifndef _WIN32
+typedef struct {
+    void      (*fn)(void *arg);
+    void       *arg;
+    TaskGroup  *group;
+} Task;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Task           *items;
+    size_t          head, tail, cap;    // [head, tail) 为有效任务
+} WorkDeque;
+
+static struct {
+    int              nthreads;
+    WorkDeque       *deques;
+    pthread_t       *threads;
+    pthread_mutex_t  lock;              // 保护 queued / shutdown / 各任务组的 pending
+    pthread_cond_t   cond;              // 有新任务或有任务组完成时广播
+    int              queued;            // 所有队列中尚未取走的任务数
+    int              shutdown;
+} g_pool = { 1, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+
+static __thread int tls_worker = 0;     // 当前线程对应的队列，主线程为 0
+
+// 放入队列尾部，内存不足无法扩容时返回 0
+static int deque_push(WorkDeque *d, Task t) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(Task));
+            d->tail -= d->head;
+            d->head = 0;
+        }
+        if (d->tail == d->cap) {
+            size_t cap = d->cap ? d->cap * 2 : 64;
+            Task *items = realloc(d->items, cap * sizeof(Task));
+            if (!items) {
+                pthread_mutex_unlock(&d->lock);
+                return 0;
+            }
+            d->items = items;
+            d->cap = cap;
+        }
+    }
+    d->items[d->tail++] = t;
+    pthread_mutex_unlock(&d->lock);
+    return 1;
+}
+
+// 所有者取最新的任务（深度优先，缓存友好）
+static int deque_pop(WorkDeque *d, Task *t) {
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *t = d->items[--d->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+// 窃取者取最早的任务（通常是更大的子树）
+static int deque_steal(WorkDeque *d, Task *t) {
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *t = d->items[d->head++];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+// 取一个任务执行，没有可做的任务时返回 0
+static int pool_run_one(void) {
+    Task t;
+    int self = tls_worker;
+    int got = deque_pop(&g_pool.deques[self], &t);
+    for (int i = 1; !got && i < g_pool.nthreads; i++) {
+        got = deque_steal(&g_pool.deques[(self + i) % g_pool.nthreads], &t);
+    }
+    if (!got) return 0;
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.queued--;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    t.fn(t.arg);
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (--t.group->pending == 0) pthread_cond_broadcast(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+    return 1;
+}
+
+static void *pool_worker(void *arg) {
+    tls_worker = (int)(intptr_t)arg;
+    for (;;) {
+        if (pool_run_one()) continue;
+        out_ring_submit();
+        pthread_mutex_lock(&g_pool.lock);
+        while (g_pool.queued == 0 && !g_pool.shutdown) pthread_cond_wait(&g_pool.cond, &g_pool.lock);
+        int stop = g_pool.shutdown && g_pool.queued == 0;
+        pthread_mutex_unlock(&g_pool.lock);
+        if (stop) break;
+    }
+    out_ring_close();
+    return NULL;
+}
+#endif
+
+// 启动线程池，nthreads 包含主线程
+void pool_init(int nthreads) {
+#ifndef _WIN32
+    if (nthreads <= 1) return;
+    g_pool.shutdown = 0;                // 库调用每次重建线程池
+    g_pool.deques = calloc((size_t)nthreads, sizeof(WorkDeque));
+    g_pool.threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!g_pool.deques || !g_pool.threads) return;
+    for (int i = 0; i < nthreads; i++) pthread_mutex_init(&g_pool.deques[i].lock, NULL);
+    g_pool.nthreads = nthreads;
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&g_pool.threads[i], NULL, pool_worker, (void *)(intptr_t)i) != 0) {
+            log_printf("Waring: Unable to create worker thread %d\n", i);
+        }
+    }
+#else
+    (void)nthreads;     // Windows 下始终串行
+#endif
+}
+
+void pool_shutdown(void) {
+#ifndef _WIN32
+    if (g_pool.nthreads <= 1) return;
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.shutdown = 1;
+    pthread_cond_broadcast(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+    for (int i = 1; i < g_pool.nthreads; i++) {
+        if (g_pool.threads[i]) pthread_join(g_pool.threads[i], NULL);
+    }
+    for (int i = 0; i < g_pool.nthreads; i++) {
+        pthread_mutex_destroy(&g_pool.deques[i].lock);
+        free(g_pool.deques[i].items);
+    }
+    free(g_pool.deques);
+    free(g_pool.threads);
+    g_pool.nthreads = 1;
+#endif
+}
+
+int pool_parallel(void) {
+#ifndef _WIN32
+    return g_pool.nthreads > 1;
+#else
+    return 0;
+#endif
+}
+
+int pool_threads(void) {
+#ifndef _WIN32
+    return g_pool.nthreads;
+#else
+    return 1;
+#endif
+}
+
+// 提交任务到当前线程的队列；串行模式下直接执行
+void task_submit(TaskGroup *group, void (*fn)(void *arg), void *arg) {
+#ifndef _WIN32
+    if (g_pool.nthreads > 1) {
+        // queued 先于入队增加：任务一旦可见就可能被窃取并减掉 queued，不能让它短暂变成负数
+        pthread_mutex_lock(&g_pool.lock);
+        group->pending++;
+        g_pool.queued++;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        Task t = { fn, arg, group };
+        int pushed = deque_push(&g_pool.deques[tls_worker], t);
+
+        pthread_mutex_lock(&g_pool.lock);
+        if (pushed) {
+            pthread_cond_broadcast(&g_pool.cond);
+        } else {
+            group->pending--;       // 队列无法扩容：就地执行
+            g_pool.queued--;
+        }
+        pthread_mutex_unlock(&g_pool.lock);
+        if (pushed) return;
+    }
+#else
+    (void)group;
+#endif
+    fn(arg);
+}
+
+// 等待任务组内的任务全部完成，等待期间帮忙执行其他任务
+void task_group_wait(TaskGroup *group) {
+#ifndef _WIN32
+    if (g_pool.nthreads <= 1) return;
+    for (;;) {
+        pthread_mutex_lock(&g_pool.lock);
+        int pending = group->pending;
+        pthread_mutex_unlock(&g_pool.lock);
+        if (pending == 0) break;
+
+        if (pool_run_one()) continue;
+
+        pthread_mutex_lock(&g_pool.lock);
+        while (group->pending > 0 && g_pool.queued == 0) pthread_cond_wait(&g_pool.cond, &g_pool.lock);
+        pthread_mutex_unlock(&g_pool.lock);
+    }
+#else
+    (void)group;
+#endif
+}
+
+/*========== 6. 递归解压 ==========*/
+// 目录项 / 嵌套压缩包任务的参数（字符串均为副本，任务结束时释放）
+struct EntryTask {
+    char *path;                 // 文件、目录或压缩包副本的完整路径
+    char *name;                 // 原始文件名
+    char *base_extract_dir;
+    char *current_path;         // 路径前缀
+    int   depth;
+    int   has_digest;
+    uint8_t digest[32];         // 压缩包的内容哈希（去重模式）
+    uint64_t *temp_bytes;       // 目录遍历任务：把文件 / 子树的总大小加到这里
+    int   dirfd;                // 目录遍历任务：所在目录的描述符，按 name 相对打开
+    int   on_stack;             // 分配失败时就地执行的任务，字符串指向调用方，不释放
+};
+
+// 结构体和各个字符串放在同一块内存里，每个任务只分配一次
+EntryTask *entry_task_new(const char *path, const char *name, const char *base_extract_dir, const char *current_path, int depth, const uint8_t *digest) {
+    if (!current_path) current_path = "";
+    size_t path_len = strlen(path) + 1;
+    size_t name_len = strlen(name) + 1;
+    size_t base_len = strlen(base_extract_dir) + 1;
+    size_t cur_len = strlen(current_path) + 1;
+    EntryTask *t = calloc(1, sizeof(EntryTask) + path_len + name_len + base_len + cur_len);
+    if (!t) return NULL;
+    char *p = (char *)(t + 1);
+    t->path = memcpy(p, path, path_len);
+    t->name = memcpy(p += path_len, name, name_len);
+    t->base_extract_dir = memcpy(p += name_len, base_extract_dir, base_len);
+    t->current_path = memcpy(p += base_len, current_path, cur_len);
+    t->depth = depth;
+    t->dirfd = -1;
+    if (digest) {
+        memcpy(t->digest, digest, sizeof(t->digest));
+        t->has_digest = 1;
+    }
+    return t;
+}
+
+static void entry_task_free(EntryTask *t) {
+    if (!t->on_stack) free(t);
+}
+
+// 作为任务提交；内存不足时记一行日志，用栈上的参数在当前线程上直接执行
+void entry_task_submit(TaskGroup *group, void (*fn)(void *arg), const char *path, const char *name, const char *base_extract_dir,
+                       const char *current_path, int depth, const uint8_t *digest, int dirfd, uint64_t *temp_bytes) {
+    EntryTask *t = entry_task_new(path, name, base_extract_dir, current_path, depth, digest);
+    if (t) {
+        t->dirfd = dirfd;
+        t->temp_bytes = temp_bytes;
+        task_submit(group, fn, t);
+        return;
+    }
+
+    log_printf("Waring: Out of memory, processing %s on the current thread\n", path);
+    EntryTask local;
+    memset(&local, 0, sizeof(local));
+    local.path = (char *)path;
+    local.name = (char *)name;
+    local.base_extract_dir = (char *)base_extract_dir;
+    local.current_path = (char *)(current_path ? current_path : "");
+    local.depth = depth;
+    local.dirfd = dirfd;
+    local.temp_bytes = temp_bytes;
+    local.on_stack = 1;
+    if (digest) {
+        memcpy(local.digest, digest, sizeof(local.digest));
+        local.has_digest = 1;
+    }
+    fn(&local);
+}
+
+// 任务：递归解压压缩包
+void extract_task(void *arg) {
+    EntryTask *t = arg;
+    recursive_extract(t->path, t->name, t->base_extract_dir, t->depth, t->base_extract_dir, t->current_path,
+                      t->has_digest ? t->digest : NULL);
+    entry_task_free(t);
+}
+
+// 任务：递归解压不保存副本的压缩包，解压完删除临时文件
+void extract_temp_task(void *arg) {
+    EntryTask *t = arg;
+    recursive_extract(t->path, t->name, t->base_extract_dir, t->depth, t->base_extract_dir, t->current_path,
+                      t->has_digest ? t->digest : NULL);
+    remove(t->path);
+    entry_task_free(t);
+}
+
+// 生成唯一的临时目录序号，并行解压的兄弟压缩包互不覆盖
+static unsigned long next_temp_id(void) {
+    static unsigned long seq = 0;
+#ifdef _WIN32
+    return ++seq;
+#else
+    return __sync_add_and_fetch(&seq, 1);
+#endif
+}
+
+#ifndef _WIN32
+/* ---- 外部解压程序（posix_spawn，不经过 shell） ---- */
+// 解到目录的子进程同时运行不超过 max_running 个。输出到管道的子进程要等调用者把输出
+// 处理完（其中可能有需要再启动子进程的嵌套压缩包）才会结束，不占名额，否则会互相等待
+static struct {
+    int             max_running;
+    int             running;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} g_spawn = { 1, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+void spawn_init(int max_running) {
+    g_spawn.max_running = max_running > 0 ? max_running : 1;
+}
+
+// 启动子进程，stderr 丢弃；stdout_fd 非 NULL 时标准输出接到管道，读端通过它返回。
+// max_file_size 非 0 时子进程在 exec 之前设好 RLIMIT_FSIZE，写出的第一个字节起就受限。失败返回 -1
+pid_t spawn_start(const char *const argv[], int *stdout_fd, uint64_t max_file_size) {
+    if (!stdout_fd) {
+        pthread_mutex_lock(&g_spawn.lock);
+        while (g_spawn.running >= g_spawn.max_running)
+            pthread_cond_wait(&g_spawn.cond, &g_spawn.lock);
+        g_spawn.running++;
+        pthread_mutex_unlock(&g_spawn.lock);
+    }
+
+    int pipe_fd[2] = { -1, -1 };
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    if (stdout_fd) {
+        // 读端必须带 O_CLOEXEC，否则并发启动的其他子进程会继承写端，管道永远等不到结束
+#ifdef __linux__
+        int rc = pipe2(pipe_fd, O_CLOEXEC);
+#else
+        int rc = pipe(pipe_fd);
+        if (rc == 0) {
+            fcntl(pipe_fd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipe_fd[1], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (rc != 0) {
+            posix_spawn_file_actions_destroy(&actions);
+            spawn_wait(-1, 1);
+            return -1;
+        }
+        posix_spawn_file_actions_adddup2(&actions, pipe_fd[1], STDOUT_FILENO);
+    }
+
+    pid_t pid;
+    int rc;
+#ifdef __linux__
+    if (max_file_size) {
+        // posix_spawn 设不了资源上限：fork 后在子进程中设置再 exec（子进程中只调用异步信号安全的函数）
+        struct rlimit rl = { (rlim_t)max_file_size, (rlim_t)max_file_size };
+        pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+            if (stdout_fd) dup2(pipe_fd[1], STDOUT_FILENO);
+            if (setrlimit(RLIMIT_FSIZE, &rl) != 0) _exit(127);
+            execvp(argv[0], (char *const *)argv);
+            _exit(127);
+        }
+        rc = pid < 0 ? errno : 0;
+    } else
+#else
+    (void)max_file_size;
+#endif
+    {
+        extern char **environ;
+        rc = posix_spawnp(&pid, argv[0], &actions, NULL, (char *const *)argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (stdout_fd) {
+        close(pipe_fd[1]);
+        if (rc != 0) close(pipe_fd[0]);
+        else *stdout_fd = pipe_fd[0];
+    }
+    if (rc != 0) {
+        spawn_wait(-1, stdout_fd != NULL);
+        return -1;
+    }
+    return pid;
+}
+
+// 等待子进程结束，解到目录的（piped 为 0）归还名额；正常退出且返回 0 时返回 1（pid 为 -1 时只归还名额）
+int spawn_wait(pid_t pid, int piped) {
+    int status = 0;
+    int ok = 0;
+    if (pid > 0) {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    if (!piped) {
+        pthread_mutex_lock(&g_spawn.lock);
+        g_spawn.running--;
+        pthread_cond_signal(&g_spawn.cond);
+        pthread_mutex_unlock(&g_spawn.lock);
+    }
+    return ok;
+}
+
+// 删除 dirfd 下的 name（文件或整个目录树），不跟随符号链接
+static int remove_tree_at(int dirfd, const char *name) {
+    if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT) return 0;
+    if (errno != EISDIR && errno != EPERM) return -1;
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (remove_tree_at(fd, entry->d_name) != 0) rc = -1;
+    }
+    closedir(dir);
+    if (unlinkat(dirfd, name, AT_REMOVEDIR) != 0 && errno != ENOENT) rc = -1;
+    return rc;
+}
+
+// 在进程内删除整个目录树，代替 rm -rf
+int remove_tree(const char *path) {
+    return remove_tree_at(AT_FDCWD, path);
+}
+
+// 运行解压程序，把结果写到 output_dir，成功返回 1
+// （输出到管道的解压程序与分类交错运行，耗时不计入 extract 阶段）
+static int spawn_extract_to_dir(const ExtractCommand *cmd) {
+    uint64_t t0 = stats_now();
+    pid_t pid = spawn_start(cmd->argv, NULL, budget_child_file_size());
+    int ok = pid > 0 && spawn_wait(pid, 0);
+    stats_time(ST_EXTRACT, t0);
+    return ok;
+}
+
+// 运行解压程序，边读它的标准输出边分类，成功返回 1
+static int spawn_extract_stream(const ExtractCommand *cmd, const char *archive_name, const char *base_extract_dir, int depth, const char *new_path) {
+    int out_fd;
+    pid_t pid = spawn_start(cmd->argv, &out_fd, 0);
+    if (pid <= 0) return 0;
+
+    FdStream out;
+    fd_stream_init(&out, out_fd);
+    int ok = decode_archive(&out.base, &cmd->dec, archive_name, base_extract_dir, depth, new_path);
+    if (ok) stream_drain(&out.base);    // 失败（如超出配额）时直接关闭管道，子进程写入时收到 SIGPIPE 退出
+    close(out_fd);
+    return spawn_wait(pid, 1) && ok;
+}
+
+/* ---- 内存暂存：外部解压程序的临时目录放在 tmpfs 上 ---- */
+// 临时目录里的文件只在分类期间存在，放在内存文件系统上可以省掉工作目录（可能是网络文件系统）上
+// 大量小文件的创建和删除。只有不超过 max_archive 的压缩包进内存，按压缩包大小的 STAGE_EXPAND_GUESS
+// 倍预估解开后的占用，所有暂存目录的预估总量不超过 budget，超出的照常解到磁盘
+#define STAGE_EXPAND_GUESS 4
+
+static struct {
+    char            root[1024];     // 本进程的暂存目录，空表示不使用
+    uint64_t        max_archive;
+    uint64_t        budget;
+    uint64_t        used;
+    unsigned long   in_memory, on_disk;
+    pthread_mutex_t lock;
+} g_stage = { "", 8ull << 20, 256ull << 20, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+// dir 为 NULL 时在 Linux 上默认使用 /dev/shm；max_archive / budget 为 0 表示保持默认值
+void stage_init(const char *dir, uint64_t max_archive, uint64_t budget) {
+    if (max_archive) g_stage.max_archive = max_archive;
+    if (budget) g_stage.budget = budget;
+#ifdef __linux__
+    if (!dir) dir = "/dev/shm";
+#endif
+    if (!dir || !*dir || access(dir, W_OK) != 0) return;
+
+    int n = snprintf(g_stage.root, sizeof(g_stage.root), "%s/tarprocess-%ld", dir, (long)getpid());
+    if (n < 0 || (size_t)n >= sizeof(g_stage.root) || mkdir(g_stage.root, 0700) != 0) {
+        log_printf("Waring: Unable to create the staging directory under %s\n", dir);
+        g_stage.root[0] = '\0';
+    }
+}
+
+// 为压缩包预留暂存空间，返回预留量；返回 0 表示应解到磁盘
+uint64_t stage_reserve(const char *archive_path) {
+    struct stat st;
+    if (!g_stage.root[0] || stat(archive_path, &st) != 0) return 0;
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t want = size * STAGE_EXPAND_GUESS + 4096;
+    uint64_t got = 0;
+    pthread_mutex_lock(&g_stage.lock);
+    if (size <= g_stage.max_archive && g_stage.used + want <= g_stage.budget) {
+        g_stage.used += want;
+        got = want;
+    } else {
+        g_stage.on_disk++;
+    }
+    pthread_mutex_unlock(&g_stage.lock);
+    return got;
+}
+
+// 归还预留量；ok 为 0 表示暂存失败（例如 tmpfs 空间不足），压缩包改解到磁盘
+void stage_release(uint64_t reserved, int ok) {
+    pthread_mutex_lock(&g_stage.lock);
+    g_stage.used -= reserved;
+    if (ok) g_stage.in_memory++;
+    else g_stage.on_disk++;
+    pthread_mutex_unlock(&g_stage.lock);
+}
+
+// 暂存目录下的临时解压目录；路径放不下时返回 0，调用者改用磁盘临时目录
+int stage_temp_path(char *path, size_t size, int depth, unsigned long id) {
+    int n = snprintf(path, size, "%s/temp_%d_%lu", g_stage.root, depth, id);
+    return n > 0 && (size_t)n < size;
+}
+
+// 删除本进程的暂存目录并输出统计
+void stage_shutdown(void) {
+    if (!g_stage.root[0]) return;
+    remove_tree(g_stage.root);
+    g_stage.root[0] = '\0';
+    if (g_stage.in_memory || g_stage.on_disk)
+        log_printf("- Staging: %lu archives unpacked in memory, %lu on disk\n", g_stage.in_memory, g_stage.on_disk);
+}
+#else
+void stage_init(const char *dir, uint64_t max_archive, uint64_t budget) {
+    (void)dir;      // Windows 下不使用暂存目录
+    (void)max_archive;
+    (void)budget;
+}
+
+void stage_shutdown(void) {
+}
+#endif
+
+/* ---- 解压配额：防止压缩炸弹 ---- */
+// 每个压缩包解码时计数：解出的字节数、成员数、解出与读入字节之比；全部压缩包的解出字节数和成员数另有合计上限。
+// 任何一项超出时解码流立即报错，当前压缩包放弃，其余照常处理。
+// 外部程序解到目录的压缩包无法边解边查，只给子进程设置单个文件的大小上限（RLIMIT_FSIZE）
+#define BUDGET_RATIO_MIN (1 << 20)      // 解出 1 MiB 之后才检查压缩比，小文件的比值没有意义
+
+static struct {
+    uint64_t      max_bytes, max_entries, max_ratio;    // 单个压缩包，0 表示不限
+    uint64_t      total_max_bytes, total_max_entries;   // 全部压缩包合计，0 表示不限
+    uint64_t      total_bytes, total_entries;
+    unsigned long aborted;
+} g_budget = { 16ull << 30, 1000000, 1000, 0, 0, 0, 0, 0 };
+
+struct Budget {
+    InStream    base;           // 解码后的流（带检查）
+    InStream    counted;        // 原始流（统计读入字节）
+    InStream   *raw;
+    InStream   *inner;
+    const char *name;
+    uint64_t    in, out, entries;
+    const char *exceeded;       // 超出的是哪一项
+};
+
+// 设置各项上限，同时清零合计（库调用每次单独计算合计）
+void budget_set(uint64_t max_bytes, uint64_t max_entries, uint64_t max_ratio, uint64_t total_max_bytes, uint64_t total_max_entries) {
+    g_budget.total_bytes = 0;
+    g_budget.total_entries = 0;
+    g_budget.max_bytes = max_bytes;
+    g_budget.max_entries = max_entries;
+    g_budget.max_ratio = max_ratio;
+    g_budget.total_max_bytes = total_max_bytes;
+    g_budget.total_max_entries = total_max_entries;
+}
+
+static uint64_t budget_add(uint64_t *total, uint64_t n) {
+#ifdef _WIN32
+    return *total += n;
+#else
+    return __atomic_add_fetch(total, n, __ATOMIC_RELAXED);
+#endif
+}
+
+#ifndef _WIN32
+static __thread unsigned long tls_aborted;      // 本线程放弃的压缩包数，批处理时各作业据此判断自己是否超限
+#endif
+
+// 记下超出的上限并让解码流报错，只打印一次
+static void budget_exceed(Budget *b, const char *what) {
+    if (b->exceeded) return;
+    b->exceeded = what;
+    b->base.error = 1;
+#ifdef _WIN32
+    g_budget.aborted++;
+#else
+    __sync_add_and_fetch(&g_budget.aborted, 1);
+    tls_aborted++;
+#endif
+    log_printf("Waring: %s limit exceeded after %llu bytes / %llu entries, aborted: %s\n", what,
+           (unsigned long long)b->out, (unsigned long long)b->entries, b->name);
+}
+
+static size_t budget_counted_read(InStream *s, void *buf, size_t n) {
+    Budget *b = (Budget *)((char *)s - offsetof(Budget, counted));
+    size_t got = b->raw->read(b->raw, buf, n);
+    if (b->raw->error) s->error = 1;
+    b->in += got;
+    return got;
+}
+
+// 解出 out 字节后检查各项上限
+static void budget_check(Budget *b, uint64_t out) {
+    b->out += out;
+    uint64_t total = budget_add(&g_budget.total_bytes, out);
+
+    if (g_budget.max_bytes && b->out > g_budget.max_bytes) budget_exceed(b, "expanded size");
+    else if (g_budget.max_ratio && b->out > BUDGET_RATIO_MIN && b->out / g_budget.max_ratio > b->in)
+        budget_exceed(b, "expansion ratio");
+    else if (g_budget.total_max_bytes && total > g_budget.total_max_bytes) budget_exceed(b, "total expanded size");
+}
+
+static size_t budget_read(InStream *s, void *buf, size_t n) {
+    Budget *b = (Budget *)s;
+    if (b->exceeded) return 0;
+    size_t got = b->inner->read(b->inner, buf, n);
+    if (b->inner->error) s->error = 1;
+    budget_check(b, got);
+    return b->exceeded ? 0 : got;
+}
+
+static void budget_close(InStream *s) {
+    (void)s;
+}
+
+// 在原始流 raw 上准备计数；解码器叠加在 b->counted 上，解码后的流交给 budget_attach
+void budget_init(Budget *b, InStream *raw, const char *name) {
+    memset(b, 0, sizeof(*b));
+    b->base.read = budget_read;
+    b->base.close = budget_close;
+    b->counted.read = budget_counted_read;
+    b->counted.close = budget_close;
+    b->raw = raw;
+    b->name = name;
+}
+
+void budget_attach(Budget *b, InStream *decoded) {
+    b->inner = decoded;
+}
+
+// 压缩包中的一个成员，超出成员数上限时返回 0
+int budget_entry(Budget *b) {
+    b->entries++;
+    uint64_t total = budget_add(&g_budget.total_entries, 1);
+    if (g_budget.max_entries && b->entries > g_budget.max_entries) budget_exceed(b, "entry count");
+    else if (g_budget.total_max_entries && total > g_budget.total_max_entries) budget_exceed(b, "total entry count");
+    return !b->exceeded;
+}
+
+// 随机访问的格式（zip）解压前按目录中声明的大小记账：in 为压缩包大小，out 为一个成员解出后的大小。
+// 成员解出的数据超过声明的大小时直接报错，所以事先检查就够了
+int budget_declare(Budget *b, uint64_t in, uint64_t out) {
+    b->in = in;
+    budget_check(b, out);
+    return !b->exceeded;
+}
+
+int budget_aborted(const Budget *b) {
+    return b->exceeded != NULL;
+}
+
+#ifndef _WIN32
+// 解到目录的外部解压程序：单个文件不超过单包上限，超出时子进程收到 SIGXFSZ 退出（0 表示不限）
+uint64_t budget_child_file_size(void) {
+    return g_budget.max_bytes;
+}
+#endif
+
+unsigned long budget_aborted_archives(void) {
+    return g_budget.aborted;
+}
+
+// 当前线程放弃的压缩包数：顶层压缩包在处理它的线程上解码，前后比较即可知道是否是它超限
+unsigned long budget_aborted_here(void) {
+#ifdef _WIN32
+    return g_budget.aborted;
+#else
+    return tls_aborted;
+#endif
+}
+
+// 输出被放弃的压缩包数
+void print_budget_stats(void) {
+    if (g_budget.aborted) log_printf("- Limits: %lu archives aborted\n", g_budget.aborted);
+}
+
+// 在进程内解码压缩包：叠加解压器后按 tar 或单文件处理
+// depth / current_path 为包内成员所在的层级与路径前缀
+int decode_archive(InStream *raw, const DecoderEntry *dec, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path) {
+    Budget budget;
+    budget_init(&budget, raw, archive_name);
+    InStream *in = &budget.counted;
+    if (dec->open) {
+        in = dec->open(&budget.counted);
+        if (!in) return 0;
+    }
+    budget_attach(&budget, in);
+
+    int ok;
+    if (dec->kind == ARCHIVE_TAR) {
+        ok = process_tar_stream(&budget.base, archive_name, base_extract_dir, depth, current_path, &budget);
+    } else {
+        // 单文件压缩：解出的文件名为去掉后缀的原名
+        char *inner_name = dup_str(archive_name);
+        size_t len = strlen(archive_name) - dec->suffix_len;
+        ok = inner_name != NULL;
+        if (ok) {
+            if (len > 0) inner_name[len] = '\0';
+            TaskGroup group = { 0 };
+            budget_entry(&budget);
+            process_entry(&budget.base, inner_name, current_path, base_extract_dir, depth, &group);
+            task_group_wait(&group);
+        }
+        free(inner_name);
+    }
+    if (in->error || budget.base.error) ok = 0;
+
+    if (in != &budget.counted) stream_close(in);
+    return ok;
+}
+
+// 递归解压已经以流形式打开的压缩包
+int recursive_extract_stream(InStream *raw, const DecoderEntry *dec, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path) {
+    if (depth > 10) {  // 防止无限递归，最大深度限制为10
+        log_printf("Warning: Maximum recursion depth reached, stopping decompression. %s\n", archive_name);
+        return 0;
+    }
+
+    if (!log_quiet()) log_printf("decompressing (depth %d): %s\n", depth, archive_name);
+    stats_depth(depth);
+
+    // 构建当前路径前缀
+    char *new_path = path_join(current_path, archive_name);
+    if (!new_path) return 0;
+
+    int ok = decode_archive(raw, dec, archive_name, base_extract_dir, depth + 1, new_path);
+    if (!ok) log_printf("Waring: decompress failed %s\n", archive_name);
+    free(new_path);
+    return ok;
+}
+
+// 解压单个压缩包文件并处理其内容，new_path 为包内成员的路径前缀
+#ifndef _WIN32
+/* ---- zip：读中央目录，成员按需并行解压 ---- */
+// 中央目录（含 zip64）给出全部成员的位置和大小，不必先整包解到临时目录。每个成员单独压缩，
+// 作为任务并行解压，按头部字节分类后不需要的成员不再往下解；被 --exclude 的成员连头部也不读。
+// 加密、分卷以及 stored / deflate 以外的压缩方法整包交给 unzip
+#define ZIP_EOCD_SIZE   22
+#define ZIP_EOCD_SEARCH (ZIP_EOCD_SIZE + 65535)     // 结尾记录 + 最长注释
+#define ZIP_CDIR_MAX    (256u << 20)                // 中央目录大小上限
+
+typedef struct {
+    uint64_t offset;        // 本地文件头位置
+    uint64_t csize, usize;
+    uint32_t crc;
+    uint16_t method;
+    char    *name;
+} ZipMember;
+
+typedef struct {
+    int         fd;
+    const char *base_extract_dir;
+    const char *current_path;
+    int         depth;
+    TaskGroup   group;
+} ZipArchive;
+
+typedef struct {
+    ZipArchive *zip;
+    ZipMember  *member;
+} ZipTask;
+
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const uint8_t *p) {
+    return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+// 一个成员的数据流：stored 直接 pread，deflate 用 zlib 的 raw inflate。
+// 解出的数据超过目录中声明的大小、长度或 CRC 不符时报错
+typedef struct {
+    InStream  base;
+    int       fd;
+    uint64_t  pos, csize_left, usize_left;
+    uint32_t  crc, expect_crc;
+    int       deflated, eof;
+    z_stream  zs;
+    uint8_t   in[STREAM_BUF_SIZE];
+} ZipStream;
+
+static size_t zip_stream_read(InStream *s, void *buf, size_t n) {
+    ZipStream *z = (ZipStream *)s;
+    if (s->error) return 0;
+    if (n > UINT32_MAX) n = UINT32_MAX;
+
+    size_t got = 0;
+    if (!z->deflated) {
+        if (n > z->csize_left) n = (size_t)z->csize_left;
+        ssize_t r = n ? pread(z->fd, buf, n, (off_t)z->pos) : 0;
+        if (r < 0 || (r == 0 && n)) {
+            s->error = 1;
+            return 0;
+        }
+        got = (size_t)r;
+        z->pos += got;
+        z->csize_left -= got;
+        stats_bytes_in(got);
+    } else if (!z->eof) {
+        z->zs.next_out = buf;
+        z->zs.avail_out = (uInt)n;
+        while (z->zs.avail_out > 0) {
+            if (z->zs.avail_in == 0 && z->csize_left > 0) {
+                size_t want = z->csize_left < sizeof(z->in) ? (size_t)z->csize_left : sizeof(z->in);
+                ssize_t r = pread(z->fd, z->in, want, (off_t)z->pos);
+                if (r <= 0) {
+                    s->error = 1;
+                    break;
+                }
+                z->zs.next_in = z->in;
+                z->zs.avail_in = (uInt)r;
+                z->pos += (uint64_t)r;
+                z->csize_left -= (uint64_t)r;
+                stats_bytes_in((uint64_t)r);
+            }
+            int rc = inflate(&z->zs, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) {
+                z->eof = 1;
+                break;
+            }
+            if (rc != Z_OK && !(rc == Z_BUF_ERROR && z->zs.avail_in == 0 && z->csize_left > 0)) {
+                s->error = 1;      // 数据损坏或被截断
+                break;
+            }
+        }
+        got = n - z->zs.avail_out;
+    }
+
+    if (got > z->usize_left) {
+        s->error = 1;
+        return 0;
+    }
+    z->usize_left -= got;
+    z->crc = (uint32_t)crc32(z->crc, buf, (uInt)got);
+    if (got == 0 && !s->error && (z->usize_left != 0 || z->crc != z->expect_crc)) s->error = 1;
+    return s->error ? 0 : got;
+}
+
+static void zip_stream_close(InStream *s) {
+    ZipStream *z = (ZipStream *)s;
+    if (z->deflated) inflateEnd(&z->zs);
+    free(z);
+}
+
+static InStream *zip_stream_open(int fd, uint64_t data_offset, const ZipMember *m) {
+    ZipStream *z = calloc(1, sizeof(ZipStream));
+    if (!z) return NULL;
+    z->base.read = zip_stream_read;
+    z->base.close = zip_stream_close;
+    z->fd = fd;
+    z->pos = data_offset;
+    z->csize_left = m->csize;
+    z->usize_left = m->usize;
+    z->expect_crc = m->crc;
+    z->deflated = m->method == 8;
+    if (z->deflated && inflateInit2(&z->zs, -MAX_WBITS) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+    return &z->base;
+}
+
+// 任务：解压并分类一个成员
+static void zip_member_task(void *arg) {
+    ZipTask *t = arg;
+    ZipArchive *zip = t->zip;
+    ZipMember *m = t->member;
+    free(t);
+
+    // 本地文件头中的文件名和扩展字段长度可能和中央目录不同，数据位置以本地文件头为准
+    uint8_t lh[30];
+    InStream *data = NULL;
+    if (pread(zip->fd, lh, sizeof(lh), (off_t)m->offset) == (ssize_t)sizeof(lh) && le32(lh) == 0x04034b50)
+        data = zip_stream_open(zip->fd, m->offset + sizeof(lh) + le16(lh + 26) + le16(lh + 28), m);
+    if (!data) {
+        log_printf("Waring: truncated archive member %s\n", m->name);
+        return;
+    }
+
+    const char *member = m->name;
+    while (member[0] == '.' && member[1] == '/') member += 2;
+    char *path_prefix = member_path_prefix(zip->current_path, member);
+    if (path_prefix) process_entry(data, member, path_prefix, zip->base_extract_dir, zip->depth, &zip->group);
+    free(path_prefix);
+    stream_close(data);
+}
+
+// 从中央目录读出成员表。返回成员数，-1 表示不是能在进程内处理的 zip（交给 unzip）
+static long zip_read_directory(int fd, uint64_t size, ZipMember **out) {
+    *out = NULL;
+    size_t tail = size < ZIP_EOCD_SEARCH ? (size_t)size : ZIP_EOCD_SEARCH;
+    if (tail < ZIP_EOCD_SIZE) return -1;
+    uint8_t *buf = malloc(tail);
+    if (!buf) return -1;
+    if (pread(fd, buf, tail, (off_t)(size - tail)) != (ssize_t)tail) {
+        free(buf);
+        return -1;
+    }
+
+    // 从后往前找结尾记录
+    long eocd = -1;
+    for (long i = (long)(tail - ZIP_EOCD_SIZE); i >= 0; i--) {
+        if (le32(buf + i) == 0x06054b50 && i + ZIP_EOCD_SIZE + le16(buf + i + 20) <= (long)tail) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        free(buf);
+        return -1;
+    }
+    uint64_t eocd_pos = size - tail + (uint64_t)eocd;
+    uint32_t disk = le16(buf + eocd + 4), cd_disk = le16(buf + eocd + 6);
+    uint64_t count = le16(buf + eocd + 10);
+    uint64_t cd_size = le32(buf + eocd + 12);
+    uint64_t cd_off = le32(buf + eocd + 16);
+    uint64_t cd_end = eocd_pos;
+    free(buf);
+
+    // zip64：结尾记录前 20 字节是 zip64 结尾记录的定位器
+    if (count == 0xFFFF || cd_size == 0xFFFFFFFF || cd_off == 0xFFFFFFFF) {
+        uint8_t loc[20], rec[56];
+        if (eocd_pos < sizeof(loc) || pread(fd, loc, sizeof(loc), (off_t)(eocd_pos - sizeof(loc))) != (ssize_t)sizeof(loc) ||
+            le32(loc) != 0x07064b50)
+            return -1;
+        uint64_t rec_pos = le64(loc + 8);
+        if (rec_pos > size - sizeof(rec) || pread(fd, rec, sizeof(rec), (off_t)rec_pos) != (ssize_t)sizeof(rec) ||
+            le32(rec) != 0x06064b50)
+            return -1;
+        disk = le32(rec + 16);
+        cd_disk = le32(rec + 20);
+        count = le64(rec + 32);
+        cd_size = le64(rec + 40);
+        cd_off = le64(rec + 48);
+        cd_end = rec_pos;
+    }
+    // 分卷不支持；中央目录之前有其他数据（自解压程序等）时整体偏移
+    if (disk != 0 || cd_disk != 0 || cd_size > ZIP_CDIR_MAX || cd_size > cd_end || cd_off > cd_end - cd_size) return -1;
+    uint64_t bias = cd_end - cd_size - cd_off;
+    if (count > cd_size / 46) return -1;
+
+    uint8_t *cd = malloc(cd_size ? (size_t)cd_size : 1);
+    ZipMember *members = calloc(count ? (size_t)count : 1, sizeof(ZipMember));
+    if (!cd || !members || pread(fd, cd, (size_t)cd_size, (off_t)(cd_off + bias)) != (ssize_t)cd_size) {
+        free(cd);
+        free(members);
+        return -1;
+    }
+
+    long n = 0;
+    int supported = 1;
+    size_t pos = 0;
+    for (uint64_t i = 0; i < count && supported; i++) {
+        const uint8_t *e = cd + pos;
+        if (pos + 46 > cd_size || le32(e) != 0x02014b50) {
+            supported = 0;
+            break;
+        }
+        uint16_t flags = le16(e + 8), method = le16(e + 10);
+        size_t name_len = le16(e + 28), extra_len = le16(e + 30), comment_len = le16(e + 32);
+        if (pos + 46 + name_len + extra_len + comment_len > cd_size) {
+            supported = 0;
+            break;
+        }
+        ZipMember m = { le32(e + 42), le32(e + 20), le32(e + 24), le32(e + 16), method, NULL };
+
+        // zip64 扩展字段：依次是原值为 0xFFFFFFFF 的解压后大小、压缩后大小、本地文件头位置
+        const uint8_t *x = e + 46 + name_len, *x_end = x + extra_len;
+        while (x + 4 <= x_end) {
+            uint16_t id = le16(x), len = le16(x + 2);
+            const uint8_t *f = x + 4, *f_end = f + len;
+            if (f_end > x_end) break;
+            if (id == 0x0001) {
+                if (m.usize == 0xFFFFFFFF && f + 8 <= f_end) { m.usize = le64(f); f += 8; }
+                if (m.csize == 0xFFFFFFFF && f + 8 <= f_end) { m.csize = le64(f); f += 8; }
+                if (m.offset == 0xFFFFFFFF && f + 8 <= f_end) { m.offset = le64(f); f += 8; }
+            }
+            x = f_end;
+        }
+        m.offset += bias;
+
+        const char *name = (const char *)e + 46;
+        uint32_t unix_mode = le32(e + 38) >> 16;
+        int is_dir = name_len == 0 || name[name_len - 1] == '/';
+        int is_link = (le16(e + 4) >> 8) == 3 && S_ISLNK(unix_mode);
+        pos += 46 + name_len + extra_len + comment_len;
+        if (is_dir || is_link) continue;         // 目录不用处理；符号链接不跟随
+        if ((flags & 1) || (method != 0 && method != 8) || m.offset >= size || m.csize > size - m.offset) {
+            supported = 0;                       // 加密、其他压缩方法或位置不对
+            break;
+        }
+        m.name = malloc(name_len + 1);
+        if (!m.name) {
+            supported = 0;
+            break;
+        }
+        memcpy(m.name, name, name_len);
+        m.name[name_len] = '\0';
+        members[n++] = m;
+    }
+    free(cd);
+
+    if (!supported) {
+        for (long i = 0; i < n; i++) free(members[i].name);
+        free(members);
+        return -1;
+    }
+    *out = members;
+    return n;
+}
+
+// 在进程内处理 zip：返回 1 成功，0 失败，-1 表示交给外部程序
+static int zip_extract_file(const char *archive_path, const char *archive_name, const char *base_extract_dir, int depth, const char *current_path) {
+    int fd = open(archive_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    ZipMember *members = NULL;
+    long count = fstat(fd, &st) == 0 ? zip_read_directory(fd, (uint64_t)st.st_size, &members) : -1;
+    if (count < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // 按目录中声明的大小先检查配额：成员解出的数据不会超过声明的大小
+    Budget budget;
+    budget_init(&budget, NULL, archive_name);
+    for (long i = 0; i < count && !budget_aborted(&budget); i++) {
+        if (budget_entry(&budget)) budget_declare(&budget, (uint64_t)st.st_size, members[i].usize);
+    }
+
+    ZipArchive zip = { fd, base_extract_dir, current_path, depth, { 0 } };
+    if (!budget_aborted(&budget)) {
+        for (long i = 0; i < count; i++) {
+            const char *member = members[i].name;
+            while (member[0] == '.' && member[1] == '/') member += 2;
+            char *path_prefix = member_path_prefix(current_path, member);
+            int skip = !path_prefix || filter_skips_name(path_prefix, get_filename(member));
+            free(path_prefix);
+            if (skip) continue;
+
+            ZipTask *t = malloc(sizeof(ZipTask));
+            if (!t) continue;
+            t->zip = &zip;
+            t->member = &members[i];
+            task_submit(&zip.group, zip_member_task, t);
+        }
+        task_group_wait(&zip.group);
+    }
+
+    for (long i = 0; i < count; i++) free(members[i].name);
+    free(members);
+    close(fd);
+    return !budget_aborted(&budget);
+}
+#endif
+
+static int extract_archive_file(const char *archive_path, const char *archive_name, const char *extract_dir, int depth, const char *base_extract_dir, const char *new_path) {
+    InStream *raw = file_stream_open(archive_path);
+    if (!raw) {
+        log_printf("Waring: decompress failed %s\n", archive_path);
+        return 0;
+    }
+
+    // 按内容选择解压器；能在进程内解码的格式直接流式处理，不再解到临时目录
+    uint8_t head[MAGIC_HEAD_SIZE];
+    size_t n = stream_read_full(raw, head, sizeof(head));
+    uint64_t t0 = stats_now();
+    int format = sniff_archive(head, n, archive_name);
+    stats_time(ST_SNIFF, t0);
+    const DecoderEntry *dec = decoder_for_format(format, archive_name);
+    if (dec) {
+        PrefixStream in;
+        prefix_stream_init(&in, raw, head, n);
+        int ok = decode_archive(&in.base, dec, archive_name, base_extract_dir, depth + 1, new_path);
+        stream_close(raw);
+        if (!ok) log_printf("Waring: decompress failed %s\n", archive_path);
+        return ok;
+    }
+    stream_close(raw);
+
+#ifndef _WIN32
+    // zip 在进程内按中央目录处理，不支持的情况再交给 unzip
+    if (format == FMT_ZIP) {
+        int ok = zip_extract_file(archive_path, archive_name, base_extract_dir, depth + 1, new_path);
+        if (ok == 0) log_printf("Waring: decompress failed %s\n", archive_path);
+        if (ok >= 0) return ok;
+    }
+#endif
+
+    // 其余交给外部解压程序读（头部已经计入读入字节）
+    struct stat st;
+    if (stats_enabled() && stat(archive_path, &st) == 0 && (uint64_t)st.st_size > n) stats_bytes_in(st.st_size - n);
+
+    // 为当前压缩包准备临时解压目录
+    char temp_extract_dir[1024];
+    snprintf(temp_extract_dir, sizeof(temp_extract_dir), "%s_temp_%d_%lu", extract_dir, depth, next_temp_id());
+
+#ifndef _WIN32
+    // 获取解压程序参数
+    ExtractCommand cmd;
+    if (!get_extract_argv(format, archive_path, temp_extract_dir, &cmd)) {
+        log_printf("Waring: Can not decompress the file: %s\n", archive_path);
+        return 0;
+    }
+
+    // 输出到标准输出的直接流式分类，不需要临时目录
+    if (cmd.to_stdout) {
+        int ok = spawn_extract_stream(&cmd, archive_name, base_extract_dir, depth + 1, new_path);
+        if (!ok) log_printf("Waring: decompress failed %s\n", archive_path);
+        return ok;
+    }
+
+    // 小压缩包解到内存文件系统上的暂存目录；放不下或失败时退回磁盘临时目录
+    uint64_t staged = stage_reserve(archive_path);
+    if (staged && !stage_temp_path(temp_extract_dir, sizeof(temp_extract_dir), depth, next_temp_id())) {
+        stage_release(staged, 0);
+        staged = 0;
+        snprintf(temp_extract_dir, sizeof(temp_extract_dir), "%s_temp_%d_%lu", extract_dir, depth, next_temp_id());
+    }
+    if (staged) {
+        get_extract_argv(format, archive_path, temp_extract_dir, &cmd);
+        my_mkdir(temp_extract_dir);
+        if (!spawn_extract_to_dir(&cmd)) {
+            cleanup_temp_dir(temp_extract_dir);
+            stage_release(staged, 0);
+            staged = 0;
+            snprintf(temp_extract_dir, sizeof(temp_extract_dir), "%s_temp_%d_%lu", extract_dir, depth, next_temp_id());
+            get_extract_argv(format, archive_path, temp_extract_dir, &cmd);
+        }
+    }
+
+    if (!staged) my_mkdir(temp_extract_dir);
+    if (!staged && !spawn_extract_to_dir(&cmd)) {
+#else
+    my_mkdir(temp_extract_dir);
+
+    // 获取解压命令
+    char extract_command[1024];
+    if (!get_extract_command(format, archive_path, temp_extract_dir, extract_command, sizeof(extract_command))) {
+        log_printf("Waring: Can not decompress the file: %s\n", archive_path);
+        cleanup_temp_dir(temp_extract_dir);
+        return 0;
+    }
+
+    // 执行解压命令
+    t0 = stats_now();
+    int result = system(extract_command);
+    stats_time(ST_EXTRACT, t0);
+    if (result != 0) {
+#endif
+        log_printf("Waring: decompress failed %s\n", archive_path);
+        cleanup_temp_dir(temp_extract_dir);
+        return 0;
+    }
+
+    // 处理解压出的文件
+    uint64_t temp_bytes = recursive_process_files(temp_extract_dir, base_extract_dir, depth + 1, new_path);
+
+    // 清理临时目录
+    cleanup_temp_dir(temp_extract_dir);
+    stats_temp(-(int64_t)temp_bytes);
+#ifndef _WIN32
+    if (staged) stage_release(staged, 1);
+#endif
+    return 1;
+}
+
+// 递归解压压缩包（archive_name 为压缩包在上一层中的原始文件名，digest 为去重模式下的内容哈希）
+int recursive_extract(const char *archive_path, const char *archive_name, const char *extract_dir, int depth, const char *base_extract_dir, const char *current_path, const uint8_t *digest) {
+    if (depth > 10) {  // 防止无限递归，最大深度限制为10
+        log_printf("Warning: Maximum recursion depth reached, stopping decompression. %s\n", archive_path);
+        return 0;
+    }
+
+    // 构建当前路径前缀
+    char *new_path = path_join(current_path, archive_name);
+    if (!new_path) return 0;
+
+    // 内容相同的压缩包已经完整展开过：按新的路径前缀链接之前的结果，不再解压
+    int claimed = 0;
+    if (digest && !filter_replayable()) digest = NULL;
+    if (digest && dedup_enabled()) {
+        char *first_path = NULL;
+        int state = dedup_claim_archive(digest, depth, new_path, &first_path);
+        if (state == DEDUP_DONE) {
+            if (!log_quiet()) log_printf("reusing (depth %d): %s (same content as %s)\n", depth, archive_name, first_path);
+            dedup_replay(first_path, new_path);
+            free(first_path);
+            free(new_path);
+            return 1;
+        }
+        claimed = (state == DEDUP_NEW);
+    }
+
+    // 之前的运行展开过相同内容的压缩包：直接链接缓存中的结果
+    if (digest && cache_enabled() && cache_replay(digest, depth, new_path)) {
+        if (!log_quiet()) log_printf("cached (depth %d): %s\n", depth, archive_name);
+        if (claimed) dedup_archive_done(digest, depth, 1);
+        free(new_path);
+        return 1;
+    }
+
+    if (!log_quiet()) log_printf("decompressing (depth %d): %s\n", depth, archive_name);
+    stats_depth(depth);
+
+    int ok = extract_archive_file(archive_path, archive_name, extract_dir, depth, base_extract_dir, new_path);
+    if (ok && digest && cache_enabled()) cache_store(digest, depth, new_path);
+    if (claimed) dedup_archive_done(digest, depth, ok);
+    free(new_path);
+    return ok;
+}
+
+#ifndef _WIN32
+/* ---- 目录遍历：按目录描述符相对打开，类型取自 d_type ---- */
+// 路径缓冲区按需增长：每个目录只保留自身路径，逐个追加 "/name" 再退回，没有长度上限
+typedef struct {
+    char  *buf;
+    size_t len, cap;
+} PathBuf;
+
+// 退回到 len 再追加 sep 和 name（原长度为 0 时不加分隔符），内存不足时返回 0
+static int path_set(PathBuf *p, size_t len, char sep, const char *name) {
+    size_t n = strlen(name);
+    if (len + n + 2 > p->cap) {
+        size_t cap = p->cap ? p->cap : 256;
+        while (cap < len + n + 2) cap *= 2;
+        char *buf = realloc(p->buf, cap);
+        if (!buf) return 0;
+        p->buf = buf;
+        p->cap = cap;
+    }
+    p->len = len;
+    if (sep && len > 0) p->buf[p->len++] = sep;
+    memcpy(p->buf + p->len, name, n + 1);
+    p->len += n;
+    return 1;
+}
+
+static uint64_t walk_dir_fd(int fd, const char *dir_path, const char *base_extract_dir, int depth, const char *current_path);
+
+// 任务：处理一个子目录
+static void walk_dir_task(void *arg) {
+    EntryTask *t = arg;
+    int fd = openat(t->dirfd, t->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        uint64_t bytes = walk_dir_fd(fd, t->path, t->base_extract_dir, t->depth, t->current_path);
+        __atomic_fetch_add(t->temp_bytes, bytes, __ATOMIC_RELAXED);
+    }
+    entry_task_free(t);
+}
+
+// 任务：分类并复制一个文件，压缩包继续递归解压
+static void walk_file_task(void *arg) {
+    EntryTask *t = arg;
+    const char *filepath = t->path;
+    const char *path_prefix = t->current_path;
+
+    // 只打开一次：分类用的头部和复制都从同一个描述符读
+    uint8_t digest[32];
+    int fd = openat(t->dirfd, t->name, O_RDONLY);
+    if (fd < 0) {
+        log_printf("Error: Unable to open the source file, %s\n", filepath);
+        entry_task_free(t);
+        return;
+    }
+    struct stat st;
+    if (stats_enabled() && fstat(fd, &st) == 0) {
+        __atomic_fetch_add(t->temp_bytes, (uint64_t)st.st_size, __ATOMIC_RELAXED);
+        stats_temp(st.st_size);
+    }
+    uint8_t head[MAGIC_HEAD_SIZE];
+    ssize_t got = pread(fd, head, sizeof(head), 0);
+    size_t n = got > 0 ? (size_t)got : 0;
+    uint64_t t0 = stats_now();
+    int format = sniff_archive(head, n, t->name);
+    int modified = format == FMT_NONE && !is_c_file(t->name) && is_modified_extension_buf(head, n, t->name);
+    stats_time(ST_SNIFF, t0);
+
+    const char *dest_dir = format != FMT_NONE ? "result/extracted_archives" :
+                           is_c_file(t->name) ? "result/extracted_c_files" :
+                           modified ? "result/extracted_modified_files" : "result/extracted_other_files";
+    if (g_visit.fn) {
+        // 访问者从头部之后接着读同一个描述符，继续处理时复制仍从文件开头开始
+        FdStream rest;
+        fd_stream_init(&rest, fd);
+        if (lseek(fd, (off_t)n, SEEK_SET) < 0 || visit_entry(&rest.base, head, n, path_prefix, t->name, dest_dir, t->depth)) {
+            close(fd);
+            entry_task_free(t);
+            return;
+        }
+    }
+    int action = filter_decide(dest_dir, path_prefix, t->name);
+    if (action == FILTER_SKIP || (format == FMT_NONE && action == FILTER_INDEX)) {
+        if (action == FILTER_INDEX && fstat(fd, &st) == 0) {
+            int hashed = sha256_fd(fd, digest);
+            manifest_add("Indexed", dest_dir, path_prefix, t->name, NULL, (uint64_t)st.st_size,
+                         magic_type_name(head, n), hashed ? digest : NULL);
+        }
+        close(fd);
+        entry_task_free(t);
+        return;
+    }
+
+    if (format != FMT_NONE) {
+        // 先提取压缩包本身到archives目录（不保存副本时直接从临时目录中的文件解压）
+        if (action == FILTER_WRITE) {
+            copy_open_file(fd, filepath, "result/extracted_archives", "压缩包", path_prefix, digest);
+        } else if (dedup_enabled() || action == FILTER_INDEX) {
+            int hashed = sha256_fd(fd, digest) && fstat(fd, &st) == 0;
+            if (hashed && action == FILTER_INDEX)
+                manifest_add("Indexed", "result/extracted_archives", path_prefix, t->name, NULL, (uint64_t)st.st_size,
+                             magic_type_name(head, n), digest);
+        }
+        close(fd);
+        // 然后递归解压
+        recursive_extract(filepath, t->name, t->base_extract_dir, t->depth, t->base_extract_dir, path_prefix,
+                          dedup_enabled() ? digest : NULL);
+    } else {
+        // 如果是普通文件，根据类型分类
+        if (is_c_file(t->name)) {
+            copy_open_file(fd, filepath, "result/extracted_c_files", "C源文件", path_prefix, digest);
+        } else {
+            if (modified) {
+                copy_open_file(fd, filepath, "result/extracted_modified_files", "修改扩展名的文件", path_prefix, digest);
+            } else {
+                // 其他文件也提取出来
+                copy_open_file(fd, filepath, "result/extracted_other_files", "其他文件", path_prefix, digest);
+            }
+        }
+        close(fd);
+    }
+    entry_task_free(t);
+}
+#endif
+
+// 递归处理文件（包括进一步解压），返回目录下文件的总大小（用于统计临时目录占用）
+uint64_t recursive_process_files(const char *current_dir, const char *base_extract_dir, int depth, const char *current_path) {
+    uint64_t temp_bytes = 0;
+#ifdef _WIN32
+    char search_path[1024];
+    snprintf(search_path, sizeof(search_path), "%s\\*", current_dir);
+
+    struct _finddata_t file_info;
+    intptr_t handle = _findfirst(search_path, &file_info);
+
+    if (handle == -1) {
+        return 0;
+    }
+
+    do {
+        if (strcmp(file_info.name, ".") == 0 || strcmp(file_info.name, "..") == 0) {
+            continue;
+        }
+
+        char filepath[1024];
+        snprintf(filepath, sizeof(filepath), "%s\\%s", current_dir, file_info.name);
+
+        // 当前路径前缀（不包含当前文件名）
+        const char *path_prefix = current_path ? current_path : "";
+
+        if (file_info.attrib & _A_SUBDIR) {
+            // 构建相对路径，递归处理子目录
+            char *relative_path = path_join(current_path, file_info.name);
+            if (relative_path) temp_bytes += recursive_process_files(filepath, base_extract_dir, depth, relative_path);
+            free(relative_path);
+        } else {
+            temp_bytes += file_info.size;
+            stats_temp(file_info.size);
+
+            // 处理文件
+            uint64_t t0 = stats_now();
+            int format = sniff_archive_file(filepath, file_info.name);
+            int modified = format == FMT_NONE && !is_c_file(file_info.name) && is_modified_extension_file(filepath);
+            stats_time(ST_SNIFF, t0);
+            const char *dest_dir = format != FMT_NONE ? "result/extracted_archives" :
+                                   is_c_file(file_info.name) ? "result/extracted_c_files" :
+                                   modified ? "result/extracted_modified_files" : "result/extracted_other_files";
+            if (g_visit.fn) {
+                InStream *in = file_stream_open(filepath);
+                uint8_t head[MAGIC_HEAD_SIZE];
+                size_t n = in ? stream_read_full(in, head, sizeof(head)) : 0;
+                int skip = in && visit_entry(in, head, n, path_prefix, file_info.name, dest_dir, depth);
+                stream_close(in);
+                if (skip) continue;
+            }
+            int action = filter_decide(dest_dir, path_prefix, file_info.name);
+            if (action == FILTER_INDEX) {
+                uint8_t digest[32];
+                int hashed = sha256_file(filepath, digest);
+                manifest_add("Indexed", dest_dir, path_prefix, file_info.name, NULL, file_info.size, NULL,
+                             hashed ? digest : NULL);
+            }
+            if (action == FILTER_SKIP || (format == FMT_NONE && action == FILTER_INDEX)) continue;
+            if (format != FMT_NONE) {
+                // 先提取压缩包本身到archives目录（不保存副本时直接从临时目录中的文件解压）
+                if (action == FILTER_WRITE)
+                    copy_file_with_path(filepath, "result/extracted_archives", "Archive file", path_prefix);
+                // 然后递归解压
+                recursive_extract(filepath, file_info.name, base_extract_dir, depth, base_extract_dir, path_prefix, NULL);
+            } else {
+                // 如果是普通文件，根据类型分类
+                if (is_c_file(file_info.name)) {
+                    copy_file_with_path(filepath, "result/extracted_c_files", "C file", path_prefix);
+                } else if (modified) {
+                    copy_file_with_path(filepath, "result/extracted_modified_files", "modified extension file", path_prefix);
+                } else {
+                    // 其他文件也提取出来
+                    copy_file_with_path(filepath, "result/extracted_other_files", "other file", path_prefix);
+                }
+            }
+        }
+    } while (_findnext(handle, &file_info) == 0);
+
+    _findclose(handle);
+#else
+    int fd = open(current_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    temp_bytes = walk_dir_fd(fd, current_dir, base_extract_dir, depth, current_path);
+#endif
+    return temp_bytes;
+}
+
+#ifndef _WIN32
+// 遍历一个已打开的目录（fd 交给 fdopendir），子目录和文件都作为任务提交，返回目录下文件的总大小。
+// 子任务按 name 相对本目录的描述符打开，只有 d_type 未知或是符号链接时才 fstatat（跟随链接，与 stat 一致）
+static uint64_t walk_dir_fd(int fd, const char *dir_path, const char *base_extract_dir, int depth, const char *current_path) {
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return 0;
+    }
+    int dfd = dirfd(dir);
+
+    PathBuf path = { NULL, 0, 0 }, chain = { NULL, 0, 0 };
+    if (!current_path) current_path = "";
+    size_t path_len = strlen(dir_path), chain_len = strlen(current_path);
+    if (!path_set(&path, 0, 0, dir_path) || !path_set(&chain, 0, 0, current_path)) {
+        closedir(dir);
+        free(path.buf);
+        return 0;
+    }
+
+    struct dirent *entry;
+    TaskGroup group = { 0 };
+    uint64_t bytes = 0;     // 文件和子目录任务累加
+
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat file_stat;
+            uint64_t t0 = stats_now();
+            int rc = fstatat(dfd, name, &file_stat, 0);
+            stats_time(ST_STAT, t0);
+            if (rc != 0) {
+                continue;
+            }
+            is_dir = S_ISDIR(file_stat.st_mode);
+        }
+        if (!path_set(&path, path_len, '/', name)) {
+            continue;
+        }
+
+        if (is_dir) {
+            // 递归处理子目录（路径前缀加上目录名）
+            if (!path_set(&chain, chain_len, '/', name)) {
+                continue;
+            }
+            entry_task_submit(&group, walk_dir_task, path.buf, name, base_extract_dir, chain.buf, depth, NULL, dfd, &bytes);
+        } else {
+            // 处理文件（路径前缀不包含当前文件名）
+            entry_task_submit(&group, walk_file_task, path.buf, name, base_extract_dir, current_path, depth, NULL, dfd, &bytes);
+        }
+    }
+
+    // 子任务还在用本目录的描述符，临时目录在返回后也会被清理，必须等本目录下的任务全部完成
+    task_group_wait(&group);
+    closedir(dir);
+    free(path.buf);
+    free(chain.buf);
+    return bytes;
+}
+#endif
+
+// 清理临时目录
+void cleanup_temp_dir(const char *temp_dir) {
+    uint64_t t0 = stats_now();
+#ifdef _WIN32
+    char command[512];
+    snprintf(command, sizeof(command), "rmdir /s /q \"%s\" 2>nul", temp_dir);
+    system(command);
+#else
+    remove_tree(temp_dir);
+#endif
+    stats_time(ST_CLEANUP, t0);
+}
+
+/*========== 7. 内容哈希与去重 ==========*/
+// --dedup 时每个输出文件在写出过程中计算 SHA-256：内容重复的文件改为指向第一份的硬链接，
+// 内容重复的压缩包不再解压，直接按新的路径前缀把第一次展开的结果再链接一遍。
+
+/* ---- SHA-256 ---- */
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(Sha256 *ctx, const uint8_t *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->h[0], b = ctx->h[1], c = ctx->h[2], d = ctx->h[3];
+    uint32_t e = ctx->h[4], f = ctx->h[5], g = ctx->h[6], h = ctx->h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+    ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+}
+
+void sha256_init(Sha256 *ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->len = 0;
+    ctx->used = 0;
+}
+
+void sha256_update(Sha256 *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    ctx->len += len;
+    if (ctx->used > 0) {
+        size_t take = 64 - ctx->used < len ? 64 - ctx->used : len;
+        memcpy(ctx->buf + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        len -= take;
+        if (ctx->used < 64) return;
+        sha256_block(ctx, ctx->buf);
+        ctx->used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) sha256_block(ctx, p);
+    memcpy(ctx->buf, p, len);
+    ctx->used = len;
+}
+
+void sha256_final(Sha256 *ctx, uint8_t digest[32]) {
+    uint64_t bits = ctx->len * 8;
+    uint8_t pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) sha256_update(ctx, &pad, 1);
+    uint8_t tail[8];
+    for (int i = 0; i < 8; i++) tail[i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_update(ctx, tail, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->h[i];
+    }
+}
+
+// 计算文件内容的 SHA-256，成功返回 1
+int sha256_file(const char *path, uint8_t digest[32]) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char *buffer = malloc(COPY_BUF_SIZE);
+    if (!buffer) {
+        fclose(fp);
+        return 0;
+    }
+    Sha256 ctx;
+    sha256_init(&ctx);
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, COPY_BUF_SIZE, fp)) > 0) sha256_update(&ctx, buffer, bytes);
+    int ok = !ferror(fp);
+    free(buffer);
+    fclose(fp);
+    sha256_final(&ctx, digest);
+    return ok;
+}
+
+#ifndef _WIN32
+// 用 pread 计算已打开文件的哈希，不改变文件位置
+int sha256_fd(int fd, uint8_t digest[32]) {
+    char *buffer = malloc(COPY_BUF_SIZE);
+    if (!buffer) return 0;
+    Sha256 ctx;
+    sha256_init(&ctx);
+    off_t offset = 0;
+    ssize_t bytes;
+    while ((bytes = pread(fd, buffer, COPY_BUF_SIZE, offset)) > 0) {
+        sha256_update(&ctx, buffer, (size_t)bytes);
+        offset += bytes;
+    }
+    free(buffer);
+    sha256_final(&ctx, digest);
+    return bytes == 0;
+}
+#endif
+
+/* ---- 去重表 ---- */
+typedef struct {
+    uint8_t  digest[32];
+    char    *path;          // 文件表：第一份输出的路径；压缩包表：第一次展开时的路径前缀
+    int      state;         // 压缩包表：DEDUP_BUSY / DEDUP_DONE
+} DigestSlot;
+
+typedef struct {
+    DigestSlot *slots;
+    size_t      cap, count;
+} DigestTable;
+
+
+static struct {
+    int            enabled;
+    DigestTable    files;
+    DigestTable    archives;
+    OutputRecord  *outputs;
+    size_t         output_count, output_cap;
+    unsigned long  linked_files;
+    unsigned long  replayed_archives;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} g_dedup = {
+    0, { NULL, 0, 0 }, { NULL, 0, 0 }, NULL, 0, 0, 0, 0,
+#ifndef _WIN32
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+static void dedup_lock(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&g_dedup.lock);
+#endif
+}
+
+static void dedup_unlock(void) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_dedup.lock);
+#endif
+}
+
+void dedup_enable(void) {
+    g_dedup.enabled = 1;
+}
+
+int dedup_enabled(void) {
+    return g_dedup.enabled;
+}
+
+// 开放寻址查找；insert 为真时找不到就占用空槽（path 仍为 NULL，由调用者填写）
+static DigestSlot *digest_table_find(DigestTable *t, const uint8_t *digest, int insert) {
+    if (insert && (t->count + 1) * 2 > t->cap) {
+        size_t new_cap = t->cap ? t->cap * 2 : 1024;
+        DigestSlot *slots = calloc(new_cap, sizeof(DigestSlot));
+        if (!slots) return NULL;
+        for (size_t i = 0; i < t->cap; i++) {
+            if (!t->slots[i].path) continue;
+            size_t j;
+            memcpy(&j, t->slots[i].digest, sizeof(j));
+            for (j %= new_cap; slots[j].path; j = (j + 1) % new_cap) {
+            }
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->cap = new_cap;
+    }
+    if (t->cap == 0) return NULL;
+
+    size_t i;
+    memcpy(&i, digest, sizeof(i));
+    for (i %= t->cap; t->slots[i].path; i = (i + 1) % t->cap) {
+        if (memcmp(t->slots[i].digest, digest, 32) == 0) return &t->slots[i];
+    }
+    if (!insert) return NULL;
+    memcpy(t->slots[i].digest, digest, 32);
+    t->count++;
+    return &t->slots[i];
+}
+
+// 用指向 first 的硬链接原子替换 dest_path，成功返回 1
+static int link_replace(const char *first, const char *dest_path) {
+#ifdef _WIN32
+    (void)first;
+    (void)dest_path;
+    return 0;
+#else
+    // 已经是同一个文件（rename 在这种情况下什么也不做，临时链接会留下）
+    struct stat a, b;
+    if (stat(first, &a) == 0 && stat(dest_path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino) return 1;
+
+    char tmp_path[2100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.dedup-tmp", dest_path);
+    unlink(tmp_path);
+    if (link(first, tmp_path) != 0) return 0;
+    if (rename(tmp_path, dest_path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+// 登记一个输出文件的内容。相同内容已有第一份时改为硬链接，返回 1
+int dedup_output(const uint8_t *digest, const char *dest_path) {
+    char *first = NULL;
+
+    dedup_lock();
+    DigestSlot *slot = digest_table_find(&g_dedup.files, digest, 1);
+    if (slot && !slot->path) {
+        slot->path = dup_str(dest_path);
+    } else if (slot && strcmp(slot->path, dest_path) != 0) {
+        first = dup_str(slot->path);
+    }
+    dedup_unlock();
+
+    if (!first) return 0;
+    int linked = link_replace(first, dest_path);
+    free(first);
+    if (linked) {
+        dedup_lock();
+        g_dedup.linked_files++;
+        dedup_unlock();
+    }
+    return linked;
+}
+
+// 记录输出位置，供内容相同的压缩包回放
+void dedup_record_output(const char *dest_dir, const char *reason, const char *relative_path, const char *filename, const char *out_path, const uint8_t *digest) {
+    dedup_lock();
+    if (g_dedup.output_count == g_dedup.output_cap) {
+        size_t new_cap = g_dedup.output_cap ? g_dedup.output_cap * 2 : 1024;
+        OutputRecord *outputs = realloc(g_dedup.outputs, new_cap * sizeof(OutputRecord));
+        if (!outputs) {
+            dedup_unlock();
+            return;
+        }
+        g_dedup.outputs = outputs;
+        g_dedup.output_cap = new_cap;
+    }
+    OutputRecord *r = &g_dedup.outputs[g_dedup.output_count++];
+    r->dest_dir = dest_dir;
+    r->reason = reason;
+    r->relative_path = dup_str(relative_path ? relative_path : "");
+    r->filename = dup_str(filename);
+    r->out_path = dup_str(out_path);
+    memcpy(r->digest, digest, sizeof(r->digest));
+    dedup_unlock();
+}
+
+// 压缩包登记表的 key：内容哈希加上深度。不同深度展开时受最大深度限制的结果可能不同，不能互相回放
+static void dedup_archive_key(const uint8_t *digest, int depth, uint8_t key[32]) {
+    Sha256 ctx;
+    uint8_t d = (uint8_t)depth;
+    sha256_init(&ctx);
+    sha256_update(&ctx, digest, 32);
+    sha256_update(&ctx, &d, 1);
+    sha256_final(&ctx, key);
+}
+
+// 登记即将在 depth 层展开的压缩包。返回 DEDUP_NEW（由调用者展开）、DEDUP_BUSY（正在别处展开，
+// 调用者照常展开）或 DEDUP_DONE（*first_path 为第一次展开时的路径前缀，需 free）
+int dedup_claim_archive(const uint8_t *digest, int depth, const char *new_path, char **first_path) {
+    int state;
+    uint8_t key[32];
+    dedup_archive_key(digest, depth, key);
+    dedup_lock();
+    DigestSlot *slot = digest_table_find(&g_dedup.archives, key, 1);
+    if (!slot) {
+        state = DEDUP_BUSY;
+    } else if (!slot->path) {
+        slot->path = dup_str(new_path);
+        slot->state = DEDUP_BUSY;
+        state = DEDUP_NEW;
+    } else {
+        state = slot->state;
+        if (state == DEDUP_DONE) *first_path = dup_str(slot->path);
+    }
+    dedup_unlock();
+    return state;
+}
+
+// 压缩包展开结束。失败的压缩包保持 DEDUP_BUSY，之后遇到相同内容仍照常展开
+void dedup_archive_done(const uint8_t *digest, int depth, int ok) {
+    uint8_t key[32];
+    dedup_archive_key(digest, depth, key);
+    dedup_lock();
+    DigestSlot *slot = digest_table_find(&g_dedup.archives, key, 0);
+    if (slot && ok) slot->state = DEDUP_DONE;
+    dedup_unlock();
+}
+
+// 取出路径前缀 prefix 下的全部输出记录（relative_path 改为去掉 prefix 后的剩余部分）
+OutputRecord *dedup_collect_outputs(const char *prefix, size_t *count) {
+    size_t prefix_len = strlen(prefix);
+
+    dedup_lock();
+    *count = 0;
+    OutputRecord *matches = malloc((g_dedup.output_count + 1) * sizeof(OutputRecord));
+    for (size_t i = 0; matches && i < g_dedup.output_count; i++) {
+        const OutputRecord *r = &g_dedup.outputs[i];
+        if (strncmp(r->relative_path, prefix, prefix_len) != 0) continue;
+        if (r->relative_path[prefix_len] != '\0' && r->relative_path[prefix_len] != '/') continue;
+        OutputRecord *m = &matches[(*count)++];
+        *m = *r;
+        m->relative_path = dup_str(r->relative_path + prefix_len);
+        m->filename = dup_str(r->filename);
+        m->out_path = dup_str(r->out_path);
+    }
+    dedup_unlock();
+    return matches;
+}
+
+void free_output_records(OutputRecord *records, size_t count) {
+    for (size_t i = 0; records && i < count; i++) {
+        free(records[i].relative_path);
+        free(records[i].filename);
+        free(records[i].out_path);
+    }
+    free(records);
+}
+
+// 把 first_path 下的全部输出按 new_path 前缀重新链接一遍
+void dedup_replay(const char *first_path, const char *new_path) {
+    size_t count;
+    OutputRecord *matches = dedup_collect_outputs(first_path, &count);
+
+    dedup_lock();
+    g_dedup.replayed_archives++;
+    dedup_unlock();
+
+    for (size_t i = 0; i < count; i++) {
+        OutputRecord *r = &matches[i];
+        char dest_path[2048];
+        size_t prefix_len = strlen(new_path), rest_len = strlen(r->relative_path) + 1;
+        char *relative_path = malloc(prefix_len + rest_len);
+        if (!relative_path) continue;
+        memcpy(relative_path, new_path, prefix_len);
+        memcpy(relative_path + prefix_len, r->relative_path, rest_len);
+        if (!make_dest_path(dest_path, sizeof(dest_path), r->dest_dir, r->filename, relative_path)) {
+            free(relative_path);
+            continue;
+        }
+
+        if (link_replace(r->out_path, dest_path)) {
+            report_output("Linked", r->reason, r->out_path, r->dest_dir, relative_path, r->filename, dest_path,
+                          UINT64_MAX, NULL, r->digest);
+            dedup_lock();
+            g_dedup.linked_files++;
+            dedup_unlock();
+            dedup_record_output(r->dest_dir, r->reason, relative_path, r->filename, dest_path, r->digest);
+        } else if (copy_path(r->out_path, dest_path) >= 0) {
+            report_output("Extracted", r->reason, r->out_path, r->dest_dir, relative_path, r->filename, dest_path,
+                          UINT64_MAX, NULL, r->digest);
+            dedup_record_output(r->dest_dir, r->reason, relative_path, r->filename, dest_path, r->digest);
+        } else {
+            log_printf("Error: Unable to copy the file, %s\n", r->out_path);
+        }
+        free(relative_path);
+    }
+    free_output_records(matches, count);
+}
+
+// 输出去重统计
+void print_dedup_stats(void) {
+    if (!g_dedup.enabled) return;
+    log_printf("- Deduplicated: %lu files linked, %lu archives reused\n", g_dedup.linked_files, g_dedup.replayed_archives);
+}
+
+/*========== 8. 持久化结果缓存 ==========*/
+// --cache DIR：按“压缩包内容哈希 + 工具/配置版本”记录每个压缩包展开后的全部输出，
+// 下次运行遇到相同的压缩包时不再解压和分类，只把缓存里的文件链接到 result 下。
+//   DIR/objects/xx/<sha256>   按内容存放的输出文件
+//   DIR/records.bin           输出记录，只追加
+//   DIR/index.bin             按 key 排序的定长索引，mmap 后二分查找
+// 多个进程可以共用一个 DIR：追加记录、合并索引时对 DIR 加 flock（Windows 上不加锁）
+#define CACHE_MAGIC         "TPCACHE1"
+#define CACHE_INDEX_VERSION 2                       // 记录格式变化时修改，旧索引整个作废
+#define CACHE_TOOL_VERSION  "tarprocess-cache-2"    // 分类规则或记录格式变化时修改
+#ifndef O_BINARY
+    #define O_BINARY 0
+#endif
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+} CacheIndexHeader;
+
+typedef struct {
+    uint8_t  key[32];
+    uint64_t offset;        // 在 records.bin 中的位置
+    uint32_t count;         // 输出记录数
+    uint32_t reserved;
+} CacheIndexEntry;
+
+// records.bin 中每条输出记录的头部，后面依次跟 relative_path 与 filename
+typedef struct {
+    uint8_t  digest[32];
+    uint8_t  category;
+    uint8_t  reserved[3];
+    uint32_t rel_len;       // 嵌套很深时路径链可以超过 64KB
+    uint32_t name_len;
+} CacheRecordHeader;
+
+static struct {
+    int               enabled;
+    char              dir[1024];
+    const CacheIndexEntry *index;       // 旧索引（mmap）
+    size_t            index_count;
+    void             *index_map;
+    size_t            index_map_size;
+    int               records_fd;       // 追加写（O_APPEND）
+    int               dir_fd;           // 用于 flock
+    CacheIndexEntry  *added;            // 本次运行新增的条目
+    size_t            added_count, added_cap;
+    unsigned long     hits, stored;
+#ifndef _WIN32
+    pthread_mutex_t   lock;
+#endif
+} g_cache = {
+    0, "", NULL, 0, NULL, 0, -1, -1, NULL, 0, 0, 0, 0,
+#ifndef _WIN32
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+static void cache_lock(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&g_cache.lock);
+#endif
+}
+
+static void cache_unlock(void) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_cache.lock);
+#endif
+}
+
+// 跨进程锁，op 为 LOCK_EX / LOCK_UN
+static void cache_flock(int op) {
+#ifndef _WIN32
+    if (g_cache.dir_fd < 0) return;
+    while (flock(g_cache.dir_fd, op) != 0 && errno == EINTR) {
+    }
+#else
+    (void)op;
+#endif
+}
+
+int cache_enabled(void) {
+    return g_cache.enabled;
+}
+
+static void cache_object_path(char *path, size_t size, const uint8_t *digest) {
+    char hex[65];
+    for (int i = 0; i < 32; i++) snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    snprintf(path, size, "%s/objects/%.2s/%s", g_cache.dir, hex, hex);
+}
+
+// 同一个压缩包在不同深度展开时，受最大深度限制的结果可能不同，深度也参与 key；筛选条件同理
+static void cache_key(const uint8_t *digest, int depth, uint8_t key[32]) {
+    Sha256 ctx;
+    uint8_t d = (uint8_t)depth;
+    sha256_init(&ctx);
+    sha256_update(&ctx, CACHE_TOOL_VERSION, strlen(CACHE_TOOL_VERSION) + 1);
+    sha256_update(&ctx, &d, 1);
+    filter_fingerprint(&ctx);
+    sha256_update(&ctx, digest, 32);
+    sha256_final(&ctx, key);
+}
+
+static int cache_entry_cmp(const void *a, const void *b) {
+    return memcmp(((const CacheIndexEntry *)a)->key, ((const CacheIndexEntry *)b)->key, 32);
+}
+
+// 读入整个文件，失败或不足一个索引头时返回 NULL
+static void *cache_read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    void *data = NULL;
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (n >= (long)sizeof(CacheIndexHeader) && (data = malloc((size_t)n)) != NULL) {
+        if (fread(data, 1, (size_t)n, fp) == (size_t)n) {
+            *size = (size_t)n;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    return data;
+}
+
+// 校验索引头，返回条目数组；格式不符返回 NULL
+static const CacheIndexEntry *cache_index_entries(const void *data, size_t size, size_t *count) {
+    const CacheIndexHeader *h = data;
+    if (memcmp(h->magic, CACHE_MAGIC, 8) != 0 || h->version != CACHE_INDEX_VERSION || h->entry_size != sizeof(CacheIndexEntry) ||
+        h->count > (size - sizeof(*h)) / sizeof(CacheIndexEntry)) {
+        return NULL;
+    }
+    *count = (size_t)h->count;
+    return (const CacheIndexEntry *)((const char *)data + sizeof(*h));
+}
+
+// 打开缓存目录并映射索引，成功返回 1
+int cache_open(const char *dir) {
+    snprintf(g_cache.dir, sizeof(g_cache.dir), "%s", dir);
+    char path[1100];
+    my_mkdir(g_cache.dir);
+    snprintf(path, sizeof(path), "%s/objects", g_cache.dir);
+    my_mkdir(path);
+
+    snprintf(path, sizeof(path), "%s/records.bin", g_cache.dir);
+    g_cache.records_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0644);
+    if (g_cache.records_fd < 0) {
+        log_printf("Error: Unable to open the cache directory: %s\n", dir);
+        return 0;
+    }
+#ifndef _WIN32
+    g_cache.dir_fd = open(g_cache.dir, O_RDONLY | O_DIRECTORY);
+#endif
+
+    snprintf(path, sizeof(path), "%s/index.bin", g_cache.dir);
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheIndexHeader)) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            g_cache.index_map = map;
+            g_cache.index_map_size = (size_t)st.st_size;
+        }
+    }
+    if (fd >= 0) close(fd);
+#else
+    g_cache.index_map = cache_read_file(path, &g_cache.index_map_size);
+#endif
+
+    // 格式不符的旧索引直接忽略，关闭时会重写
+    if (g_cache.index_map) g_cache.index = cache_index_entries(g_cache.index_map, g_cache.index_map_size, &g_cache.index_count);
+
+    g_cache.enabled = 1;
+    return 1;
+}
+
+// 查找 key，返回索引条目的副本
+static int cache_find(const uint8_t *key, CacheIndexEntry *found) {
+    CacheIndexEntry probe;
+    memcpy(probe.key, key, 32);
+    const CacheIndexEntry *e = NULL;
+    if (g_cache.index_count) {
+        e = bsearch(&probe, g_cache.index, g_cache.index_count, sizeof(CacheIndexEntry), cache_entry_cmp);
+    }
+    if (e) {
+        *found = *e;
+        return 1;
+    }
+
+    // 本次运行新增、还没写进索引的条目
+    int ok = 0;
+    cache_lock();
+    for (size_t i = 0; i < g_cache.added_count && !ok; i++) {
+        if (memcmp(g_cache.added[i].key, key, 32) == 0) {
+            *found = g_cache.added[i];
+            ok = 1;
+        }
+    }
+    cache_unlock();
+    return ok;
+}
+
+// 读出一个条目的全部输出记录
+static OutputRecord *cache_read_records(const CacheIndexEntry *e, size_t *count) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/records.bin", g_cache.dir);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    OutputRecord *records = calloc(e->count + 1, sizeof(OutputRecord));
+    size_t n = 0;
+    if (records && fseek(fp, (long)e->offset, SEEK_SET) == 0) {
+        for (; n < e->count; n++) {
+            CacheRecordHeader h;
+            if (fread(&h, sizeof(h), 1, fp) != 1 || h.category >= OUTPUT_CATEGORIES) break;
+            OutputRecord *r = &records[n];
+            r->relative_path = calloc(1, (size_t)h.rel_len + 1);
+            r->filename = calloc(1, (size_t)h.name_len + 1);
+            if (!r->relative_path || !r->filename ||
+                fread(r->relative_path, 1, h.rel_len, fp) != h.rel_len ||
+                fread(r->filename, 1, h.name_len, fp) != h.name_len) {
+                n++;
+                break;
+            }
+            memcpy(r->digest, h.digest, 32);
+            r->dest_dir = output_categories[h.category].dest_dir;
+            r->reason = output_categories[h.category].reason;
+        }
+    }
+    fclose(fp);
+
+    if (!records || n != e->count || (n > 0 && !records[n - 1].filename)) {
+        free_output_records(records, n);
+        return NULL;
+    }
+    *count = n;
+    return records;
+}
+
+// 命中缓存时把压缩包的全部输出复制到 new_path 前缀下，返回 1；未命中或缓存不完整返回 0。
+// 对象不与 result/ 中的文件共用 inode（能 reflink 时不复制数据），result/ 中的文件被改写也不会污染缓存
+int cache_replay(const uint8_t *digest, int depth, const char *new_path) {
+    uint8_t key[32];
+    CacheIndexEntry e;
+    cache_key(digest, depth, key);
+    if (!cache_find(key, &e)) return 0;
+
+    size_t count = 0;
+    OutputRecord *records = cache_read_records(&e, &count);
+    if (!records) return 0;
+
+    // 任何一个对象缺失都按未命中处理，宁可重新解压
+    char object_path[1200];
+    struct stat st;
+    for (size_t i = 0; i < count; i++) {
+        cache_object_path(object_path, sizeof(object_path), records[i].digest);
+        if (stat(object_path, &st) != 0) {
+            free_output_records(records, count);
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        OutputRecord *r = &records[i];
+        char dest_path[2048];
+        size_t prefix_len = strlen(new_path), rest_len = strlen(r->relative_path) + 1;
+        char *relative_path = malloc(prefix_len + rest_len);
+        if (!relative_path) continue;
+        memcpy(relative_path, new_path, prefix_len);
+        memcpy(relative_path + prefix_len, r->relative_path, rest_len);
+        if (!make_dest_path(dest_path, sizeof(dest_path), r->dest_dir, r->filename, relative_path)) {
+            free(relative_path);
+            continue;
+        }
+        cache_object_path(object_path, sizeof(object_path), r->digest);
+
+        // 本次运行已有相同内容的输出时链接到它，否则从对象复制
+        int linked = dedup_output(r->digest, dest_path);
+        if (linked || copy_path(object_path, dest_path) >= 0) {
+            report_output(linked ? "Linked" : "Cached", r->reason, object_path, r->dest_dir, relative_path, r->filename,
+                          dest_path, UINT64_MAX, NULL, r->digest);
+            dedup_record_output(r->dest_dir, r->reason, relative_path, r->filename, dest_path, r->digest);
+        } else {
+            log_printf("Error: Unable to copy the file, %s\n", object_path);
+        }
+        free(relative_path);
+    }
+    free_output_records(records, count);
+
+    cache_lock();
+    g_cache.hits++;
+    cache_unlock();
+    return 1;
+}
+
+// 把 new_path 前缀下的全部输出存入缓存
+void cache_store(const uint8_t *digest, int depth, const char *new_path) {
+    size_t count;
+    OutputRecord *records = dedup_collect_outputs(new_path, &count);
+    if (!records) return;
+
+    // 先把输出文件复制进对象目录：写到临时名再改名，对象只读，且不与 result/ 中的文件共用 inode
+    char object_path[1200];
+    char tmp_path[1300];
+    char object_dir[1200];
+    struct stat st;
+    for (size_t i = 0; i < count; i++) {
+        cache_object_path(object_path, sizeof(object_path), records[i].digest);
+        if (stat(object_path, &st) == 0) continue;
+        snprintf(object_dir, sizeof(object_dir), "%.*s", (int)(strrchr(object_path, '/') - object_path), object_path);
+        my_mkdir(object_dir);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%lu.tmp", object_path, next_temp_id());
+        if (copy_path(records[i].out_path, tmp_path) < 0) {
+            remove(tmp_path);
+            free_output_records(records, count);
+            return;
+        }
+#ifndef _WIN32
+        chmod(tmp_path, 0444);
+#endif
+        if (rename(tmp_path, object_path) != 0) {
+            remove(tmp_path);
+            free_output_records(records, count);
+            return;
+        }
+    }
+
+    // 整个压缩包的记录拼成一块，持锁用一次 write 追加，别的进程的记录不会插进中间
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) size += sizeof(CacheRecordHeader) + strlen(records[i].relative_path) + strlen(records[i].filename);
+    char *buf = malloc(size ? size : 1);
+    if (!buf) {
+        free_output_records(records, count);
+        return;
+    }
+    char *p = buf;
+    for (size_t i = 0; i < count; i++) {
+        const OutputRecord *r = &records[i];
+        CacheRecordHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.digest, r->digest, 32);
+        for (int c = 0; c < OUTPUT_CATEGORIES; c++) {
+            if (strcmp(r->dest_dir, output_categories[c].dest_dir) == 0) h.category = (uint8_t)c;
+        }
+        h.rel_len = (uint32_t)strlen(r->relative_path);
+        h.name_len = (uint32_t)strlen(r->filename);
+        memcpy(p, &h, sizeof(h));
+        p += sizeof(h);
+        memcpy(p, r->relative_path, h.rel_len);
+        p += h.rel_len;
+        memcpy(p, r->filename, h.name_len);
+        p += h.name_len;
+    }
+    size = (size_t)(p - buf);
+
+    CacheIndexEntry e;
+    memset(&e, 0, sizeof(e));
+    cache_key(digest, depth, e.key);
+    e.count = (uint32_t)count;
+
+    // 写失败时不登记索引，留在文件里的半截记录没有条目引用
+    cache_lock();
+    cache_flock(LOCK_EX);
+    off_t end = lseek(g_cache.records_fd, 0, SEEK_END);
+    size_t done = 0;
+    while (end >= 0 && done < size) {
+        ssize_t n = write(g_cache.records_fd, buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    cache_flock(LOCK_UN);
+    e.offset = (uint64_t)end;
+    if (end < 0 || done != size) {
+        log_printf("Waring: Unable to write the cache records for %s\n", new_path);
+    } else {
+        if (g_cache.added_count == g_cache.added_cap) {
+            size_t new_cap = g_cache.added_cap ? g_cache.added_cap * 2 : 256;
+            CacheIndexEntry *added = realloc(g_cache.added, new_cap * sizeof(CacheIndexEntry));
+            if (added) {
+                g_cache.added = added;
+                g_cache.added_cap = new_cap;
+            }
+        }
+        if (g_cache.added_count < g_cache.added_cap) {
+            g_cache.added[g_cache.added_count++] = e;
+            g_cache.stored++;
+        }
+    }
+    cache_unlock();
 
-    // tarǷ
-    struct stat file_stat;
-    if (stat(tar_path, &file_stat) != 0) {
-        printf("Error: Can not find the file: %s\n", tar_path);
-        return 1;
+    free(buf);
+    free_output_records(records, count);
+}
+
+// 持锁重新读入磁盘上的索引（其他进程可能已经更新过），合并本次新增的条目后原子地重写
+void cache_close(void) {
+    if (!g_cache.enabled) return;
+    close(g_cache.records_fd);
+    g_cache.records_fd = -1;
+
+    if (g_cache.added_count > 0) {
+        char path[1100], tmp_path[1200];
+        snprintf(path, sizeof(path), "%s/index.bin", g_cache.dir);
+        snprintf(tmp_path, sizeof(tmp_path), "%s/index.bin.%ld.%lu.tmp", g_cache.dir, (long)getpid(), next_temp_id());
+
+        cache_flock(LOCK_EX);
+        size_t disk_size = 0, disk_count = 0;
+        void *disk = cache_read_file(path, &disk_size);
+        const CacheIndexEntry *disk_entries = disk ? cache_index_entries(disk, disk_size, &disk_count) : NULL;
+        if (!disk_entries) disk_count = 0;
+
+        size_t total = disk_count + g_cache.added_count;
+        CacheIndexEntry *all = malloc(total * sizeof(CacheIndexEntry));
+        if (all) {
+            if (disk_count) memcpy(all, disk_entries, disk_count * sizeof(CacheIndexEntry));
+            memcpy(all + disk_count, g_cache.added, g_cache.added_count * sizeof(CacheIndexEntry));
+            qsort(all, total, sizeof(CacheIndexEntry), cache_entry_cmp);
+
+            size_t unique = 0;
+            for (size_t i = 0; i < total; i++) {
+                if (unique > 0 && memcmp(all[unique - 1].key, all[i].key, 32) == 0) continue;
+                all[unique++] = all[i];
+            }
+
+            FILE *fp = fopen(tmp_path, "wb");
+            if (fp) {
+                CacheIndexHeader h;
+                memset(&h, 0, sizeof(h));
+                memcpy(h.magic, CACHE_MAGIC, 8);
+                h.version = CACHE_INDEX_VERSION;
+                h.entry_size = sizeof(CacheIndexEntry);
+                h.count = unique;
+                int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+                         fwrite(all, sizeof(CacheIndexEntry), unique, fp) == unique;
+                ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+                remove(path);
+#endif
+                if (!ok || rename(tmp_path, path) != 0) {
+                    log_printf("Waring: Unable to write the cache index %s\n", path);
+                    remove(tmp_path);
+                }
+            }
+            free(all);
+        }
+        cache_flock(LOCK_UN);
+        free(disk);
     }
 
-    printf("Begin to process the archive file: %s\n", tar_path);
+#ifndef _WIN32
+    if (g_cache.index_map) munmap(g_cache.index_map, g_cache.index_map_size);
+#else
+    free(g_cache.index_map);
+#endif
+#ifndef _WIN32
+    if (g_cache.dir_fd >= 0) close(g_cache.dir_fd);
+    g_cache.dir_fd = -1;
+#endif
+    free(g_cache.added);
+    log_printf("- Cache: %lu archives reused, %lu archives stored\n", g_cache.hits, g_cache.stored);
+    g_cache.enabled = 0;
+}
 
-    // Ŀ¼
-    create_output_dirs();
+/*========== 9. 运行统计 ==========*/
+// --stats / --stats-json FILE 时收集：各阶段的次数与耗时分布、读入与写出字节数、各类输出文件数、
+// 到达的最大嵌套深度、临时目录的峰值占用。计数按线程分开累加，结束时合并，热路径上不争用同一缓存行。
+// 耗时直方图按微秒取 2 的幂分桶：第 0 桶不足 1us，第 b 桶为 [2^(b-1), 2^b) us
+#define STATS_BUCKETS 32
+
+static const char *const stats_stage_names[ST_STAGES] = { "extract", "stat", "sniff", "copy", "cleanup" };
+
+typedef struct RunStats {
+    uint64_t count[ST_STAGES];
+    uint64_t total_ns[ST_STAGES];
+    uint64_t max_ns[ST_STAGES];
+    uint64_t hist[ST_STAGES][STATS_BUCKETS];
+    uint64_t bytes_in, bytes_out;
+    uint64_t files[OUTPUT_CATEGORIES];
+    uint64_t linked;
+    struct RunStats *next;
+} RunStats;
+
+static struct {
+    int       on;
+    uint64_t  start_ns;
+    RunStats *threads;          // 各线程的计数块
+    int       max_depth;
+    int64_t   temp_bytes;       // 临时目录当前占用（磁盘和内存暂存合计）
+    int64_t   temp_peak;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} g_stats = {
+    0, 0, NULL, 0, 0, 0,
+#ifndef _WIN32
+    PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+#ifndef _WIN32
+static __thread RunStats *tls_stats = NULL;
+#endif
+
+// 当前线程的计数块
+static RunStats *stats_local(void) {
+#ifdef _WIN32
+    if (!g_stats.threads) g_stats.threads = calloc(1, sizeof(RunStats));
+    return g_stats.threads;
+#else
+    if (tls_stats) return tls_stats;
+    RunStats *s = calloc(1, sizeof(RunStats));
+    if (!s) return NULL;
+    pthread_mutex_lock(&g_stats.lock);
+    s->next = g_stats.threads;
+    g_stats.threads = s;
+    pthread_mutex_unlock(&g_stats.lock);
+    tls_stats = s;
+    return s;
+#endif
+}
+
+void stats_enable(void) {
+    g_stats.on = 1;
+    g_stats.start_ns = stats_now();
+}
+
+int stats_enabled(void) {
+    return g_stats.on;
+}
+
+// 单调时钟（纳秒），未开启统计时返回 0，不读时钟
+uint64_t stats_now(void) {
+    if (!g_stats.on) return 0;
+#ifdef _WIN32
+    return (uint64_t)clock() * (1000000000ull / CLOCKS_PER_SEC);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// 记录一次从 start 开始的阶段耗时
+void stats_time(int stage, uint64_t start) {
+    if (!g_stats.on) return;
+    RunStats *s = stats_local();
+    if (!s) return;
+    uint64_t ns = stats_now() - start;
+    uint64_t us = ns / 1000;
+    int b = 0;
+    while (us && b < STATS_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    s->count[stage]++;
+    s->total_ns[stage] += ns;
+    if (ns > s->max_ns[stage]) s->max_ns[stage] = ns;
+    s->hist[stage][b]++;
+}
+
+// 从压缩包读入的字节数
+void stats_bytes_in(uint64_t n) {
+    if (!g_stats.on) return;
+    RunStats *s = stats_local();
+    if (s) s->bytes_in += n;
+}
+
+// 一个输出文件：按分类计数，硬链接的不算写出字节
+void stats_output(const char *dest_dir, int linked, uint64_t size) {
+    if (!g_stats.on) return;
+    RunStats *s = stats_local();
+    if (!s) return;
+    for (int c = 0; c < OUTPUT_CATEGORIES; c++) {
+        if (strcmp(dest_dir, output_categories[c].dest_dir) == 0) s->files[c]++;
+    }
+    if (linked) s->linked++;
+    else if (size != UINT64_MAX) s->bytes_out += size;
+}
+
+void stats_depth(int depth) {
+    if (!g_stats.on) return;
+#ifdef _WIN32
+    if (depth > g_stats.max_depth) g_stats.max_depth = depth;
+#else
+    int cur = __atomic_load_n(&g_stats.max_depth, __ATOMIC_RELAXED);
+    while (depth > cur && !__atomic_compare_exchange_n(&g_stats.max_depth, &cur, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+#endif
+}
+
+// 临时目录占用变化（解出的文件被遍历到时增加，目录清理后减去）
+void stats_temp(int64_t delta) {
+    if (!g_stats.on) return;
+#ifdef _WIN32
+    g_stats.temp_bytes += delta;
+    if (g_stats.temp_bytes > g_stats.temp_peak) g_stats.temp_peak = g_stats.temp_bytes;
+#else
+    int64_t now = __atomic_add_fetch(&g_stats.temp_bytes, delta, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&g_stats.temp_peak, __ATOMIC_RELAXED);
+    while (now > peak && !__atomic_compare_exchange_n(&g_stats.temp_peak, &peak, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+#endif
+}
+
+// 合并各线程的计数（在线程池关闭后调用）
+static void stats_merge(RunStats *total) {
+    memset(total, 0, sizeof(*total));
+    for (RunStats *s = g_stats.threads; s; s = s->next) {
+        for (int st = 0; st < ST_STAGES; st++) {
+            total->count[st] += s->count[st];
+            total->total_ns[st] += s->total_ns[st];
+            if (s->max_ns[st] > total->max_ns[st]) total->max_ns[st] = s->max_ns[st];
+            for (int b = 0; b < STATS_BUCKETS; b++) total->hist[st][b] += s->hist[st][b];
+        }
+        total->bytes_in += s->bytes_in;
+        total->bytes_out += s->bytes_out;
+        for (int c = 0; c < OUTPUT_CATEGORIES; c++) total->files[c] += s->files[c];
+        total->linked += s->linked;
+    }
+}
+
+// 直方图中第 q 百分位所在桶的上界（纳秒），不超过最大值
+static uint64_t stats_percentile(const RunStats *t, int stage, int q) {
+    uint64_t want = (t->count[stage] * q + 99) / 100;
+    uint64_t seen = 0;
+    int b;
+    for (b = 0; b < STATS_BUCKETS; b++) {
+        seen += t->hist[stage][b];
+        if (seen >= want) break;
+    }
+    uint64_t bound = b < STATS_BUCKETS ? (1ull << b) * 1000 : t->max_ns[stage];
+    return bound < t->max_ns[stage] ? bound : t->max_ns[stage];
+}
+
+// 耗时格式化为 us / ms / s
+static const char *stats_fmt_ns(uint64_t ns, char *buf, size_t size) {
+    if (ns < 1000000) snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, size, "%.1fms", ns / 1e6);
+    else snprintf(buf, size, "%.2fs", ns / 1e9);
+    return buf;
+}
+
+// 字节数格式化为 B / K / M / G
+static const char *stats_fmt_bytes(uint64_t n, char *buf, size_t size) {
+    if (n < 1024) snprintf(buf, size, "%lluB", (unsigned long long)n);
+    else if (n < (1ull << 20)) snprintf(buf, size, "%.1fK", n / 1024.0);
+    else if (n < (1ull << 30)) snprintf(buf, size, "%.1fM", n / 1048576.0);
+    else snprintf(buf, size, "%.2fG", n / 1073741824.0);
+    return buf;
+}
+
+// 输出统计报告
+void stats_print(void) {
+    if (!g_stats.on) return;
+    RunStats t;
+    stats_merge(&t);
+    char a[32], b[32], c[32], d[32], e[32];
+
+    printf("- Stats: %s elapsed\n", stats_fmt_ns(stats_now() - g_stats.start_ns, a, sizeof(a)));
+    printf("    %-8s %8s %10s %10s %10s %10s %10s\n", "stage", "count", "total", "avg", "p50<=", "p99<=", "max");
+    for (int st = 0; st < ST_STAGES; st++) {
+        if (!t.count[st]) continue;
+        printf("    %-8s %8llu %10s %10s %10s %10s %10s\n", stats_stage_names[st], (unsigned long long)t.count[st],
+               stats_fmt_ns(t.total_ns[st], a, sizeof(a)),
+               stats_fmt_ns(t.total_ns[st] / t.count[st], b, sizeof(b)),
+               stats_fmt_ns(stats_percentile(&t, st, 50), c, sizeof(c)),
+               stats_fmt_ns(stats_percentile(&t, st, 99), d, sizeof(d)),
+               stats_fmt_ns(t.max_ns[st], e, sizeof(e)));
+    }
+    printf("    bytes in %s, out %s\n", stats_fmt_bytes(t.bytes_in, a, sizeof(a)), stats_fmt_bytes(t.bytes_out, b, sizeof(b)));
+    printf("    files:");
+    for (int i = 0; i < OUTPUT_CATEGORIES; i++) printf(" %s %llu", output_categories[i].key, (unsigned long long)t.files[i]);
+    printf(" (%llu linked)\n", (unsigned long long)t.linked);
+    printf("    max depth %d, peak temp usage %s\n", g_stats.max_depth,
+           stats_fmt_bytes((uint64_t)g_stats.temp_peak, a, sizeof(a)));
+}
+
+// 把统计写成 JSON，失败返回 0
+int stats_write_json(const char *path) {
+    if (!g_stats.on) return 1;
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        log_printf("Error: Unable to open the stats file, %s\n", path);
+        return 0;
+    }
+    RunStats t;
+    stats_merge(&t);
+
+    fprintf(fp, "{\n  \"elapsed_ns\": %llu,\n  \"stages\": {", (unsigned long long)(stats_now() - g_stats.start_ns));
+    for (int st = 0; st < ST_STAGES; st++) {
+        fprintf(fp, "%s\n    \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"hist_us_log2\": [",
+                st ? "," : "", stats_stage_names[st], (unsigned long long)t.count[st],
+                (unsigned long long)t.total_ns[st], (unsigned long long)t.max_ns[st]);
+        for (int b = 0; b < STATS_BUCKETS; b++) fprintf(fp, "%s%llu", b ? "," : "", (unsigned long long)t.hist[st][b]);
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  },\n  \"bytes_in\": %llu,\n  \"bytes_out\": %llu,\n  \"files\": {",
+            (unsigned long long)t.bytes_in, (unsigned long long)t.bytes_out);
+    for (int i = 0; i < OUTPUT_CATEGORIES; i++)
+        fprintf(fp, "%s\"%s\": %llu", i ? ", " : "", output_categories[i].key, (unsigned long long)t.files[i]);
+    fprintf(fp, "},\n  \"linked\": %llu,\n  \"max_depth\": %d,\n  \"peak_temp_bytes\": %lld\n}\n",
+            (unsigned long long)t.linked, g_stats.max_depth, (long long)g_stats.temp_peak);
+
+    if (fclose(fp) != 0) {
+        log_printf("Waring: Unable to write the stats file, %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+/*========== 10. 顶层入口与库接口 ==========*/
+#define INPUT_PEEK_SIZE (64 * 1024)  // 外层是单文件压缩时，为判断解出的是否为 tar 包读入的压缩数据量
+
+static size_t empty_stream_read(InStream *s, void *buf, size_t n) {
+    (void)s; (void)buf; (void)n;
+    return 0;
+}
+
+static void empty_stream_close(InStream *s) {
+    (void)s;
+}
+
+// 只解码已读入的开头一段，看解出的内容是否为 tar 包（数据不完整引起的解码错误不用管）
+static int decoded_is_tar(const DecoderEntry *dec, const uint8_t *head, size_t n) {
+    InStream empty = { empty_stream_read, empty_stream_close, 0 };
+    PrefixStream in;
+    prefix_stream_init(&in, &empty, head, n);
+    InStream *s = dec->open(&in.base);
+    if (!s) return 0;
+    uint8_t block[MAGIC_HEAD_SIZE];
+    size_t got = stream_read_full(s, block, sizeof(block));
+    stream_close(s);
+    return sniff_archive(block, got, "") == FMT_TAR;
+}
+
+// 把已读入的开头和流的其余部分写到 path（buf 用作缓冲区）
+static int spool_stream(InStream *in, uint8_t *buf, size_t n, size_t cap, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return 0;
+    int ok = 1;
+    do {
+        if (fwrite(buf, 1, n, fp) != n) ok = 0;
+    } while (ok && (n = stream_read_full(in, buf, cap)) > 0);
+    if (in->error) ok = 0;
+    if (fclose(fp) != 0) ok = 0;
+    return ok;
+}
+
+// 处理一个顶层压缩包：外层压缩按开头的内容识别，边读边分类；解不了时交给系统 tar 解到 temp_dir 再遍历。
+// "-" 为标准输入，标准输入和命名管道同样流式读取，不先落盘，但只能读一遍，失败时没有系统 tar 可退。
+// chain 为成员路径链的起点（批处理时是作业名，单个压缩包时为空）。成功返回 1
+int run_archive(const char *tar_path, const char *temp_dir, const char *chain) {
+    int from_stdin = strcmp(tar_path, "-") == 0;
+    const char *name = from_stdin ? "stdin" : get_filename(tar_path);
+    struct stat st;
+    int seekable = !from_stdin && stat(tar_path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+    InStream *tar_in = input_stream_open(tar_path);
+    uint8_t *head = tar_in ? malloc(INPUT_PEEK_SIZE) : NULL;
+    if (!head) {
+        if (tar_in) stream_close(tar_in);
+        log_printf("Error: Can not find the file: %s\n", tar_path);
+        return 0;
+    }
+    size_t n = stream_read_full(tar_in, head, MAGIC_HEAD_SIZE);
+    int format = sniff_archive(head, n, name);
+    const DecoderEntry *dec = decoder_for_format(format, name);
+    DecoderEntry tar_dec;
+    if (dec && dec->kind == ARCHIVE_SINGLE && find_decoder(name) != dec) {
+        // 文件名说明不了解出的是什么（标准输入、管道或后缀不符）：解出开头看是否为 tar 包
+        n += stream_read_full(tar_in, head + n, INPUT_PEEK_SIZE - n);
+        if (decoded_is_tar(dec, head, n)) {
+            tar_dec = *dec;
+            tar_dec.kind = ARCHIVE_TAR;
+            dec = &tar_dec;
+        }
+    }
+
+    if (!dec && (format == FMT_ZIP || format == FMT_7Z || format == FMT_RAR)) {
+        // zip 要从末尾的中央目录读起，7z、rar 交给外部程序：文件直接交出去，流先写到工作目录。
+        // 成员的深度与 tar 包中的一样从 0 开始
+        char spool[1100];
+        snprintf(spool, sizeof(spool), "%s_input", temp_dir);
+        const char *path = tar_path;
+        int ok = 1;
+        if (!seekable) {
+            path = spool;
+            ok = spool_stream(tar_in, head, n, INPUT_PEEK_SIZE, spool);
+            if (!ok) log_printf("Error: Unable to save the input to %s\n", spool);
+        }
+        stream_close(tar_in);
+        free(head);
+        if (ok) ok = extract_archive_file(path, name, temp_dir, -1, temp_dir, chain);
+        if (!seekable) remove(spool);
+        return ok;
+    }
+    if (!dec) dec = find_decoder(name);
+    if (!dec) dec = find_decoder(".tar");      // 不是认识的格式时按后缀读，没有可识别的后缀时按普通 tar 读
+
+    PrefixStream in;
+    prefix_stream_init(&in, tar_in, head, n);
+    unsigned long aborted = budget_aborted_here();
+    int stream_ok = decode_archive(&in.base, dec, name, temp_dir, 0, chain);
+    stream_close(tar_in);
+    free(head);
+    if (stream_ok || budget_aborted_here() != aborted) return 1;
+    if (!seekable) {
+        // 已经读过的数据无法再交给系统 tar
+        log_printf("Error: Unable to extract the tar archive; it may not be a valid tar file.\n");
+        return 0;
+    }
 
-    // ʱȡĿ¼
-    const char *temp_dir = "temp_extract_dir";
+    // 无法在进程内解码，交给系统 tar 解包
     my_mkdir(temp_dir);
 
-    // ȡtar
-    char extract_command[512];
 #ifdef _WIN32
-    // WindowsʹtarWindows 10ϰ汾Դ
+    // Windows下使用tar命令（Windows 10及以上版本自带）
+    char extract_command[512];
     snprintf(extract_command, sizeof(extract_command), "tar -xf \"%s\" -C \"%s\" 2>nul", tar_path, temp_dir);
+    uint64_t t0 = stats_now();
+    int extract_ok = system(extract_command) == 0;
 #else
-    snprintf(extract_command, sizeof(extract_command), "tar -xf \"%s\" -C \"%s\" 2>/dev/null", tar_path, temp_dir);
+    const char *tar_argv[] = { "tar", "-xf", tar_path, "-C", temp_dir, NULL };
+    uint64_t t0 = stats_now();
+    pid_t tar_pid = spawn_start(tar_argv, NULL, budget_child_file_size());
+    int extract_ok = tar_pid > 0 && spawn_wait(tar_pid, 0);
 #endif
-
-    int extract_result = system(extract_command);
-    if (extract_result != 0) {
-        printf("Error: Unable to extract the tar archive; it may not be a valid tar file.\n");
+    stats_time(ST_EXTRACT, t0);
+    if (!extract_ok) {
+        log_printf("Error: Unable to extract the tar archive; it may not be a valid tar file.\n");
         cleanup_temp_dir(temp_dir);
-        return 1;
+        return 0;
     }
 
-    printf("The tar archive has been extracted. Starting recursive analysis and file decompression...\n");
+    log_printf("The tar archive has been extracted. Starting recursive analysis and file decompression...\n");
 
-    // ݹ鴦ȡļһѹǶ׵ѹ
-    recursive_process_files(temp_dir, temp_dir, 0, "");
+    // 递归处理提取的文件（包括进一步解压嵌套的压缩包）
+    uint64_t temp_bytes = recursive_process_files(temp_dir, temp_dir, 0, chain);
 
-    // ʱĿ¼
+    // 清理临时目录
     cleanup_temp_dir(temp_dir);
+    stats_temp(-(int64_t)temp_bytes);
+    return 1;
+}
+
+#ifndef _WIN32
+// 库入口不可重入：线程池、配额、输出根目录、访问者和日志回调都是进程内的全局量，
+// 每次调用时按 tp_options 设置、返回前恢复，同时调用时依次执行。
+// 按调用划分的上下文没有做：这些状态贯穿整条解压路径，一次调用内的并行靠 jobs
+static pthread_mutex_t g_lib_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int tp_process(const char *path, const tp_options *opt) {
+    tp_options defaults;
+    if (!opt) {
+        memset(&defaults, 0, sizeof(defaults));
+        opt = &defaults;
+    }
+    // 回调里再调用会等自己释放 g_lib_lock
+    if (tls_in_callback) return -1;
+#ifndef _WIN32
+    pthread_mutex_lock(&g_lib_lock);
+#endif
+    log_set_sink(opt->log, opt->log_ctx);
+
+    // 输出根目录放不下时报错，不截断成另一个目录
+    if (opt->output_dir && !output_set_root(opt->output_dir)) {
+        log_printf("Error: The output directory is too long: %s\n", opt->output_dir);
+        log_set_sink(NULL, NULL);
+#ifndef _WIN32
+        pthread_mutex_unlock(&g_lib_lock);
+#endif
+        return -1;
+    }
+
+    // 临时文件放在本次调用独占的目录下，同一目录里的多个进程或多次调用互不干扰
+    char work[1024], temp_dir[1100];
+    snprintf(work, sizeof(work), "%s/tarprocess.XXXXXX", opt->work_dir ? opt->work_dir : ".");
+#ifdef _WIN32
+    int made = _mktemp(work) != NULL && my_mkdir(work) == 0;
+#else
+    int made = mkdtemp(work) != NULL;
+#endif
+    if (!made) {
+        log_printf("Error: Unable to create the work directory under %s\n", opt->work_dir ? opt->work_dir : ".");
+        log_set_sink(NULL, NULL);
+        output_set_root("result");
+#ifndef _WIN32
+        pthread_mutex_unlock(&g_lib_lock);
+#endif
+        return -1;
+    }
+    snprintf(temp_dir, sizeof(temp_dir), "%s/temp_extract_dir", work);
+
+    // 不写文件时只展开压缩包，其余成员只交给访问者
+    unsigned saved_mask = g_filter.write_mask;
+    int saved_quiet = log_quiet();
+    if (opt->output_dir) {
+        create_output_dirs();
+    } else {
+        g_filter.write_mask = 0;
+    }
+    log_set_quiet(opt->quiet);
+    budget_set(opt->max_bytes ? opt->max_bytes : 16ull << 30, opt->max_entries ? opt->max_entries : 1000000,
+               opt->max_ratio ? opt->max_ratio : 1000, opt->max_total_bytes, opt->max_total_entries);
+    g_visit.fn = opt->visit;
+    g_visit.ctx = opt->ctx;
+
+    pool_init(opt->jobs);
+#ifndef _WIN32
+    spawn_init(opt->jobs);
+#endif
+    int ok = run_archive(path, temp_dir, "");
+    pool_shutdown();
+    out_ring_close();
+    cleanup_temp_dir(work);
+
+    g_visit.fn = NULL;
+    g_visit.ctx = NULL;
+    g_filter.write_mask = saved_mask;
+    log_set_quiet(saved_quiet);
+    log_set_sink(NULL, NULL);
+    output_set_root("result");
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_lib_lock);
+#endif
+    return ok ? 0 : -1;
+}
+
+#ifndef TARPROCESS_LIB
+/* ---- 批处理：多个压缩包共用线程池、去重表和缓存 ---- */
+// 压缩包来自参数列表、--batch 列表文件（- 为标准输入）或 --listen 本地套接字，每个作为一个任务提交，
+// -j N 时多个作业同时进行。各作业的临时目录在本进程独占的工作目录下按作业编号分开，
+// 输出都在 result/ 中，路径链以作业名（压缩包文件名，重名时加 ~N）开头，互不覆盖
+typedef struct BatchConn {
+    int       fd;               // 套接字连接，作业完成时回一行 "ok <path>" 或 "fail <path>"
+    TaskGroup group;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    struct BatchConn *next;     // --listen 正在服务的连接
+#endif
+} BatchConn;
+
+typedef struct {
+    BatchConn    *conn;         // NULL 表示不回复
+    unsigned long id;
+    char         *name;         // 作业名，提交时按顺序分配，重名的编号不受调度影响
+    char          path[];
+} BatchJob;
+
+static struct {
+    char          work[64];     // 本进程的工作目录，各作业的临时目录建在其下
+    unsigned long next_id;
+    unsigned long done, failed;
+    TaskGroup     group;
+    volatile int  stop;
+} g_batch;
+
+// 作业名：压缩包文件名，本次运行中重名时改为 name~N。在堆上分配，内存不足时返回 NULL
+static char *batch_job_name(const char *path) {
+    const char *base = strcmp(path, "-") == 0 ? "stdin" : get_filename(path);
+    size_t size = strlen(base) + 24;
+    char *key = malloc(size + 1);
+    if (!key) return NULL;
+    key[0] = '\n';             // 与输出路径共用占用表，加前缀区分
+#ifndef _WIN32
+    pthread_mutex_lock(&g_layout.lock);
+#endif
+    snprintf(key + 1, size, "%s", base);
+    for (unsigned long n = 1; !layout_claim(key); n++) snprintf(key + 1, size, "%s~%lu", base, n);
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_layout.lock);
+#endif
+    memmove(key, key + 1, strlen(key));
+    return key;
+}
+
+static void batch_job_task(void *arg) {
+    BatchJob *job = arg;
+    char temp_dir[128];
+    snprintf(temp_dir, sizeof(temp_dir), "%s/job_%lu", g_batch.work, job->id);
+
+    if (!log_quiet()) log_printf("Begin to process the archive file: %s\n", job->path);
+    int ok = run_archive(job->path, temp_dir, job->name);
+#ifdef _WIN32
+    g_batch.done++;
+    if (!ok) g_batch.failed++;
+#else
+    __sync_add_and_fetch(&g_batch.done, 1);
+    if (!ok) __sync_add_and_fetch(&g_batch.failed, 1);
+    if (job->conn) {
+        // 回复整行写出，路径不截断
+        size_t cap = strlen(job->path) + 8;
+        char *line = malloc(cap);
+        int len = line ? snprintf(line, cap, "%s %s\n", ok ? "ok" : "fail", job->path) : -1;
+        pthread_mutex_lock(&job->conn->lock);
+        if (len > 0 && write(job->conn->fd, line, (size_t)len) < 0) {
+            // 对方已经断开，结果仍然写入 result/
+        }
+        pthread_mutex_unlock(&job->conn->lock);
+        free(line);
+    }
+#endif
+    free(job->name);
+    free(job);
+}
+
+// 在提交线程上依次编号、命名，-j N 时重名作业的 ~N 仍按提交顺序分配
+static void batch_submit(const char *path, BatchConn *conn) {
+    size_t len = strlen(path);
+    BatchJob *job = malloc(sizeof(BatchJob) + len + 1);
+    char *name = job ? batch_job_name(path) : NULL;
+    if (!name) {
+        log_printf("Error: Unable to queue the archive file: %s\n", path);
+        free(job);
+        return;
+    }
+    job->conn = conn;
+    job->name = name;
+#ifdef _WIN32
+    job->id = g_batch.next_id++;
+#else
+    job->id = __sync_fetch_and_add(&g_batch.next_id, 1);    // --listen 时各连接的读取线程同时提交
+#endif
+    memcpy(job->path, path, len + 1);
+    task_submit(conn ? &conn->group : &g_batch.group, batch_job_task, job);
+}
+
+// 收到 SIGINT / SIGTERM 后不再读入新的路径（信号处理函数和各连接的读取线程都会访问）
+static int batch_stopped(void) {
+#ifdef _WIN32
+    return g_batch.stop;
+#else
+    return __atomic_load_n(&g_batch.stop, __ATOMIC_RELAXED);
+#endif
+}
+
+// 逐行读取压缩包路径并提交，读完后等全部作业结束
+static void batch_read_lines(FILE *fp, BatchConn *conn) {
+    char line[4096];
+    while (!batch_stopped() && fgets(line, sizeof(line), fp)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len > 0) batch_submit(line, conn);
+    }
+    task_group_wait(conn ? &conn->group : &g_batch.group);
+}
+
+#ifndef _WIN32
+// --listen 正在服务的连接，每个连接一个读取线程
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;           // 有连接结束时广播
+    BatchConn      *conns;
+    pthread_t       accept_thread;
+} g_listen = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 };
+
+static void batch_on_signal(int sig) {
+    __atomic_store_n(&g_batch.stop, 1, __ATOMIC_RELAXED);
+    // 信号落在其他线程上时转给接受连接的线程，让 accept 返回
+    if (!pthread_equal(pthread_self(), g_listen.accept_thread)) pthread_kill(g_listen.accept_thread, sig);
+}
+
+// 读取线程：提交本连接的全部路径，等这些作业完成后断开
+static void *batch_conn_thread(void *arg) {
+    BatchConn *conn = arg;
+    FILE *fp = fdopen(conn->fd, "r");
+    if (fp) batch_read_lines(fp, conn);
+    out_ring_close();       // 等待期间帮忙执行的任务可能在本线程的环上写了文件
+
+    pthread_mutex_lock(&g_listen.lock);
+    BatchConn **p = &g_listen.conns;
+    while (*p != conn) p = &(*p)->next;
+    *p = conn->next;
+    pthread_cond_broadcast(&g_listen.cond);
+    pthread_mutex_unlock(&g_listen.lock);
+
+    if (fp) fclose(fp);
+    else close(conn->fd);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn);
+    return NULL;
+}
+
+// 为连接启动读取线程。-j 1 时只有一个执行者，或者线程创建失败时，在当前线程上处理完再接受下一个连接
+static void batch_conn_start(int fd) {
+    BatchConn *conn = calloc(1, sizeof(BatchConn));
+    if (!conn) {
+        close(fd);
+        return;
+    }
+    conn->fd = fd;
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_mutex_lock(&g_listen.lock);
+    conn->next = g_listen.conns;
+    g_listen.conns = conn;
+    pthread_mutex_unlock(&g_listen.lock);
+
+    pthread_t tid;
+    if (pool_parallel() && pthread_create(&tid, NULL, batch_conn_thread, conn) == 0) {
+        pthread_detach(tid);
+    } else {
+        batch_conn_thread(conn);
+    }
+}
+
+// --listen：在本地套接字上接受连接，连接中每行一个路径，对方关闭写端后等本连接的作业完成再断开。
+// 各连接由自己的读取线程提交作业，多个客户端的作业同时进入共用的线程池。
+// SIGINT / SIGTERM 后不再接受新连接，已连接的不再读入新路径，等已提交的作业完成后正常收尾
+int batch_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_printf("Error: Socket path is too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
 
-    printf("\nProcess Done\n");
+    // 只替换之前留下的套接字，不删除同名的普通文件
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            log_printf("Error: %s exists and is not a socket\n", path);
+            return 0;
+        }
+        unlink(path);
+    }
+    int srv = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (srv < 0 || bind(srv, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(srv, 16) != 0) {
+        log_printf("Error: Unable to listen on %s\n", path);
+        if (srv >= 0) close(srv);
+        return 0;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = batch_on_signal;     // 不设 SA_RESTART，accept 被信号打断后返回
+    g_listen.accept_thread = pthread_self();
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    log_printf("Listening on %s\n", path);
+
+    while (!batch_stopped()) {
+        int fd = accept(srv, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            log_printf("Error: Unable to accept a connection on %s\n", path);
+            break;
+        }
+        batch_conn_start(fd);
+    }
+    close(srv);
+    unlink(path);
+
+    // 关闭各连接的读端，读取线程不再等新的路径，等它们的作业完成
+    pthread_mutex_lock(&g_listen.lock);
+    for (BatchConn *c = g_listen.conns; c; c = c->next) shutdown(c->fd, SHUT_RD);
+    while (g_listen.conns) pthread_cond_wait(&g_listen.cond, &g_listen.lock);
+    pthread_mutex_unlock(&g_listen.lock);
+    return 1;
+}
+#endif
+
+// 创建本进程的工作目录（当前目录下 tarprocess.XXXXXX），多个进程在同一目录中运行互不干扰
+static int work_dir_create(char *work, size_t size) {
+    snprintf(work, size, "tarprocess.XXXXXX");
+#ifdef _WIN32
+    return _mktemp(work) != NULL && my_mkdir(work) == 0;
+#else
+    return mkdtemp(work) != NULL;
+#endif
+}
+
+// 解析带单位的大小（K/M/G），出错返回 0
+static uint64_t parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    }
+    return (end == s || *end != '\0') ? 0 : (uint64_t)v;
+}
+
+// 解析上限值（可带 K/M/G，0 表示不限），出错返回 0
+static int parse_limit(const char *s, uint64_t *out) {
+    *out = parse_size(s);
+    return *out != 0 || strcmp(s, "0") == 0;
+}
+
+int main(int argc, char *argv[]) {
+    // 解析参数：[-j N] [-d] [--cache DIR] [--stage DIR|off] [--stage-max SIZE] [--stage-budget SIZE] [--fsync] [--no-uring] [--manifest FILE] [-q] [--stats] [--stats-json FILE] [--max-bytes SIZE] [--max-entries N] [--max-ratio N] [--total-bytes SIZE] [--total-entries N] [--only LIST] [--include GLOB] [--exclude GLOB] [--index-only] [--layout flat|sharded] [--batch FILE] [--listen PATH] <archive file path>...
+    const char *tar_path = NULL;
+    const char **tar_paths = calloc((size_t)argc, sizeof(char *));
+    int n_paths = 0;
+    const char *batch_path = NULL;
+    const char *listen_path = NULL;
+    const char *cache_dir = NULL;
+    const char *stage_dir = NULL;
+    const char *manifest_path = NULL;
+    const char *stats_path = NULL;
+    int show_stats = 0;
+    int index_only = 0;
+    uint64_t stage_max = 0, stage_budget = 0;
+    uint64_t max_bytes = 16ull << 30, max_entries = 1000000, max_ratio = 1000, total_bytes = 0, total_entries = 0;
+    int jobs = 1;
+    int bad_args = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--dedup") == 0) {
+            dedup_enable();
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+            dedup_enable();     // 缓存按内容哈希查找，需要记录每个输出的哈希
+        } else if (strcmp(argv[i], "--fsync") == 0) {
+            out_set_fsync(1);
+        } else if (strcmp(argv[i], "--no-uring") == 0) {
+            out_ring_disable();
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest_path = argv[++i];
+        } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+            log_set_quiet(1);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--stage") == 0 && i + 1 < argc) {
+            stage_dir = argv[++i];
+            if (strcmp(stage_dir, "off") == 0) stage_dir = "";
+        } else if (strcmp(argv[i], "--stage-max") == 0 && i + 1 < argc) {
+            if (!(stage_max = parse_size(argv[++i]))) bad_args = 1;
+        } else if (strcmp(argv[i], "--stage-budget") == 0 && i + 1 < argc) {
+            if (!(stage_budget = parse_size(argv[++i]))) bad_args = 1;
+        } else if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc) {
+            if (!parse_limit(argv[++i], &max_bytes)) bad_args = 1;
+        } else if (strcmp(argv[i], "--max-entries") == 0 && i + 1 < argc) {
+            if (!parse_limit(argv[++i], &max_entries)) bad_args = 1;
+        } else if (strcmp(argv[i], "--max-ratio") == 0 && i + 1 < argc) {
+            if (!parse_limit(argv[++i], &max_ratio)) bad_args = 1;
+        } else if (strcmp(argv[i], "--total-bytes") == 0 && i + 1 < argc) {
+            if (!parse_limit(argv[++i], &total_bytes)) bad_args = 1;
+        } else if (strcmp(argv[i], "--total-entries") == 0 && i + 1 < argc) {
+            if (!parse_limit(argv[++i], &total_entries)) bad_args = 1;
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            if (!filter_set_categories(argv[++i])) bad_args = 1;
+        } else if ((strcmp(argv[i], "--include") == 0 || strcmp(argv[i], "--exclude") == 0) && i + 1 < argc) {
+            if (!filter_add_glob(argv[i + 1], argv[i][2] == 'e')) bad_args = 1;
+            i++;
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            if (!layout_set(argv[++i])) bad_args = 1;
+        } else if (strcmp(argv[i], "--index-only") == 0) {
+            index_only = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            jobs = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+#ifndef _WIN32
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_path = argv[++i];
+#endif
+        } else if (tar_paths) {
+            tar_paths[n_paths++] = argv[i];
+        } else {
+            bad_args = 1;
+        }
+    }
+    // 多个压缩包、--batch 或 --listen 时按批处理运行
+    int batch = n_paths > 1 || batch_path || listen_path;
+    if (n_paths == 1 && !batch) tar_path = tar_paths[0];
+    if (index_only && !manifest_path) {
+        printf("Error: --index-only requires --manifest\n");
+        bad_args = 1;
+    }
+    filter_set_index_only(index_only);
+    if ((!tar_path && !batch) || bad_args || jobs < 1) {
+        printf("use: %s [-j N] [-d] [--cache DIR] [--stage DIR|off] [--stage-max SIZE] [--stage-budget SIZE] [--fsync] [--no-uring] [--manifest FILE] [-q] [--stats] [--stats-json FILE] [--max-bytes SIZE] [--max-entries N] [--max-ratio N] [--total-bytes SIZE] [--total-entries N] [--only LIST] [--include GLOB] [--exclude GLOB] [--index-only] [--layout flat|sharded] [--batch FILE] [--listen PATH] <archive file path>...\n", argv[0]);
+        printf("  -j N          process directory entries and nested archives on N threads (default 1)\n");
+        printf("  -d, --dedup   hardlink outputs with identical content and reuse results of identical archives\n");
+        printf("  --cache DIR   keep results of nested archives in DIR and reuse them on later runs (implies -d)\n");
+        printf("  --stage DIR   unpack small zip/7z/rar archives under DIR (default /dev/shm on Linux, off to disable)\n");
+        printf("  --stage-max SIZE     largest archive unpacked in the staging directory (default 8M)\n");
+        printf("  --stage-budget SIZE  estimated staging space in use at once (default 256M)\n");
+        printf("  --fsync       flush every output file to disk before closing it\n");
+        printf("  --no-uring    write small outputs synchronously instead of batching them through io_uring\n");
+        printf("  --manifest FILE  write one JSON line per output file (path chain, category, size, type, sha256) to FILE\n");
+        printf("  -q, --quiet   do not print a line for every output file\n");
+        printf("  --stats       print per-stage timings, byte and file counts, max depth and peak temp usage\n");
+        printf("  --stats-json FILE  write the same statistics to FILE as JSON\n");
+        printf("  --max-bytes SIZE     abort an archive that expands to more than SIZE (default 16G, 0 = no limit)\n");
+        printf("  --max-entries N      abort an archive with more than N entries (default 1000000)\n");
+        printf("  --max-ratio N        abort an archive that expands more than N times its size (default 1000)\n");
+        printf("  --total-bytes SIZE   stop expanding archives after SIZE in total (default no limit)\n");
+        printf("  --total-entries N    stop expanding archives after N entries in total (default no limit)\n");
+        printf("  --only LIST   write only these categories: c, archive, modified, other (comma separated)\n");
+        printf("  --include GLOB       write only files matching GLOB (repeatable; a GLOB with '/' matches the path chain)\n");
+        printf("  --exclude GLOB       do not write files matching GLOB, and do not expand matching archives (repeatable)\n");
+        printf("  --layout sharded     spread outputs over hashed subdirectories, rename duplicates to name~N,\n");
+        printf("                       and record the original path chains in result/paths.jsonl (default flat)\n");
+        printf("  --index-only  record files that are not written in the manifest (name, size, sha256) instead of skipping them\n");
+        printf("  --batch FILE  also process the archives listed in FILE, one path per line (- for stdin)\n");
+#ifndef _WIN32
+        printf("  --listen PATH        accept archive paths on the local socket PATH, one per line, and reply ok/fail per archive\n");
+#endif
+        printf("  An archive path of - reads the archive from stdin; stdin and named pipes are decoded as the data arrives.\n");
+        printf("  Several archives are processed concurrently under -j N, sharing the workers and the dedup tables;\n");
+        printf("  each one's outputs are prefixed with its file name.\n");
+        free(tar_paths);
+        return 1;
+    }
+
+    // 检查tar包是否存在（批处理时各作业自己检查，"-" 为标准输入）
+    struct stat file_stat;
+    if (!batch && strcmp(tar_path, "-") != 0 && stat(tar_path, &file_stat) != 0) {
+        printf("Error: Can not find the file: %s\n", tar_path);
+        free(tar_paths);
+        return 1;
+    }
+
+    if (!batch) printf("Begin to process the archive file: %s\n", tar_path);
+    if (show_stats || stats_path) stats_enable();
+    budget_set(max_bytes, max_entries, max_ratio, total_bytes, total_entries);
+
+    // 创建输出目录
+    create_output_dirs();
+
+    // 临时提取目录放在本进程的工作目录下（外部命令解压的嵌套压缩包解到它的同级目录 temp_extract_dir_temp_*）
+    if (!work_dir_create(g_batch.work, sizeof(g_batch.work))) {
+        printf("Error: Unable to create the work directory %s\n", g_batch.work);
+        free(tar_paths);
+        return 1;
+    }
+    char temp_dir[128];
+    snprintf(temp_dir, sizeof(temp_dir), "%s/temp_extract_dir", g_batch.work);
+
+    if (!layout_open() || (cache_dir && !cache_open(cache_dir))) {
+        cleanup_temp_dir(g_batch.work);
+        free(tar_paths);
+        return 1;
+    }
+    if (manifest_path && !manifest_open(manifest_path)) {
+        cache_close();
+        cleanup_temp_dir(g_batch.work);
+        free(tar_paths);
+        return 1;
+    }
+
+    pool_init(jobs);
+#ifndef _WIN32
+    spawn_init(jobs);
+#endif
+    stage_init(stage_dir, stage_max, stage_budget);
+
+    int run_ok = 1;
+    if (!batch) {
+        printf("Starting streaming analysis and recursive decompression...\n");
+        run_ok = run_archive(tar_path, temp_dir, "");
+    } else {
+        for (int i = 0; i < n_paths; i++) batch_submit(tar_paths[i], NULL);
+        if (batch_path) {
+            FILE *list = strcmp(batch_path, "-") == 0 ? stdin : fopen(batch_path, "r");
+            if (list) {
+                batch_read_lines(list, NULL);
+                if (list != stdin) fclose(list);
+            } else {
+                printf("Error: Can not find the file: %s\n", batch_path);
+                run_ok = 0;
+            }
+        }
+        task_group_wait(&g_batch.group);
+#ifndef _WIN32
+        if (listen_path && run_ok && !batch_listen(listen_path)) run_ok = 0;
+#endif
+    }
+    free(tar_paths);
+    if (!run_ok) {
+        pool_shutdown();
+        out_ring_close();
+        stage_shutdown();
+        cache_close();
+        manifest_close();
+        cleanup_temp_dir(g_batch.work);
+        return 1;
+    }
+
+    pool_shutdown();
+    out_ring_close();
+    cleanup_temp_dir(g_batch.work);
+
+    printf("\nProcess Done！\n");
     printf("- C file has been saved to: result/extracted_c_files/\n");
     printf("- archive file has been saved to: result/extracted_archives/\n");
     printf("- The file with the modified extension has been saved to: result/extracted_modified_files/\n");
     printf("- Other file has been saved to: result/extracted_other_files/\n");
-    return 0;
-}
\ No newline at end of file
+    print_copy_stats();
+    print_output_stats();
+    print_dedup_stats();
+    print_budget_stats();
+    print_filter_stats();
+    if (batch) printf("- Batch: %lu archives processed, %lu failed\n", g_batch.done, g_batch.failed);
+    layout_close();
+    stage_shutdown();
+    cache_close();
+    manifest_close();
+    if (show_stats) stats_print();
+    if (stats_path && !stats_write_json(stats_path)) return 1;
+    return g_batch.failed ? 1 : 0;
+}
+#endif
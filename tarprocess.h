@@ -0,0 +1,75 @@
+#ifndef TARPROCESS_H
+#define TARPROCESS_H
+// 库接口：把 main.c 编译为库（gcc -c -DTARPROCESS_LIB main.c）即可在进程内处理压缩包，
+// 每个成员交给调用方的访问者回调，不必启动 tarprocess 再解析它的输出
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 成员分类，与清单中的 category 一一对应
+enum {
+    TP_C_SOURCE,            // c_source
+    TP_ARCHIVE,             // archive
+    TP_MODIFIED,            // modified_extension
+    TP_OTHER                // other
+};
+
+// 访问者的返回值
+enum {
+    TP_CONTINUE = 0,        // 照常处理：写到 output_dir（若有），压缩包继续展开
+    TP_SKIP     = 1         // 到此为止：不写出，压缩包也不展开
+};
+
+typedef struct {
+    const char    *chain;       // 所在的压缩包和目录路径链，顶层为 ""
+    const char    *name;        // 文件名
+    int            category;    // TP_C_SOURCE 等
+    const char    *type;        // 按内容识别出的格式（gz、zip、tar…），不认识时为 NULL
+    int            depth;       // 嵌套层数，顶层压缩包中的成员为 0
+    const uint8_t *head;        // 内容开头（最多 512 字节），不读取也可以查看
+    size_t         head_len;
+} tp_entry;
+
+typedef struct tp_reader tp_reader;
+
+// 读取成员内容（从头开始），返回 0 表示读完；之后用 tp_reader_error 区分正常结束和截断、超出配额
+size_t tp_read(tp_reader *r, void *buf, size_t n);
+int tp_reader_error(const tp_reader *r);
+
+// 每个成员调用一次。jobs > 1 时会在多个线程上同时调用。
+// 读取了 head 之外的数据后，成员视为已由访问者处理，返回值按 TP_SKIP 对待
+typedef int (*tp_visit_fn)(void *ctx, const tp_entry *entry, tp_reader *data);
+
+// 诊断信息（错误、警告，quiet 为 0 时还有每个文件的日志），每次一行，不含换行。jobs > 1 时会在多个线程上同时调用
+typedef void (*tp_log_fn)(void *ctx, const char *line);
+
+typedef struct {
+    int          jobs;          // 线程数，<= 1 时串行
+    const char  *output_dir;    // 分类目录的上级目录（其下为 extracted_c_files 等），NULL 表示不写文件；最长 1023 字节
+    const char  *work_dir;      // 临时目录建在这里（每次调用一个独立目录），NULL 表示当前目录
+    tp_visit_fn  visit;         // 可以为 NULL
+    void        *ctx;           // 原样传给 visit
+    int          quiet;         // 不打印每个文件的日志
+    uint64_t     max_bytes;     // 单个压缩包的解码上限，0 取默认值（16G、1000000、1000）
+    uint64_t     max_entries;
+    uint64_t     max_ratio;
+    uint64_t     max_total_bytes;   // 本次调用中全部压缩包的合计上限，0 表示不限
+    uint64_t     max_total_entries;
+    tp_log_fn    log;           // NULL 时写到标准输出
+    void        *log_ctx;       // 原样传给 log
+} tp_options;
+
+// 处理一个压缩包，成功返回 0。
+// 不可重入：运行状态（线程池、配额、输出根目录、访问者、日志回调）是进程内共享的，每次调用时设置、返回前恢复，
+// 没有按调用划分的上下文。多个线程同时调用时依次执行，要并行处理请用 jobs 或多个进程。
+// 在 visit 或 log 回调中调用时直接返回 -1
+int tp_process(const char *path, const tp_options *opt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif